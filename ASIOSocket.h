@@ -1,11 +1,28 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cassert>
+#include <new>
+#include <span>
 #include <type_traits>
 
 #include <asio/ts/net.hpp>
 
+#include "./Errors.h"
 #include "./IAsyncIO.h"
 
+// blocks of operation memory every asio socket keeps for itself, and their size.
+// a socket has a read and a write in flight at most, each holding one block.
+#ifndef ASIO_HANDLER_ARENA_BLOCKS
+#define ASIO_HANDLER_ARENA_BLOCKS 4
+#endif
+
+#ifndef ASIO_HANDLER_ARENA_BLOCK_SIZE
+#define ASIO_HANDLER_ARENA_BLOCK_SIZE 512
+#endif
+
 namespace xpo {
 	namespace net {
 		template <class T>
@@ -23,6 +40,133 @@ namespace xpo {
 		template <class T>
 		constexpr bool is_asio_socket_v = is_asio_socket<T>::value;
 
+		// maps gather buffers onto an asio buffer sequence without allocating.
+		// one per socket is enough since only one gather write is in flight at a time.
+		// a write with more than ASYNC_IO_MAX_BUFFERS buffers is rejected before it gets here, see fits().
+		struct ASIOGatherBuffers {
+			std::span<asio::const_buffer const> map(std::span<ConstByteBuffer const> buffers) {
+				assert(fits(buffers));
+				for (std::size_t i = 0; i < buffers.size(); ++i) {
+					m_buffers[i] = asio::const_buffer(buffers[i].data, buffers[i].size);
+				}
+				return { m_buffers.data(), buffers.size() };
+			}
+
+			static bool fits(std::span<ConstByteBuffer const> buffers) {
+				return buffers.size() <= ASYNC_IO_MAX_BUFFERS;
+			}
+
+			// fails a write that doesn't fit with MessageTooLarge, never inline
+			template <class Executor, class F>
+			static void reject(Executor const& executor, F&& callback) {
+				asio::post(executor, [callback = std::forward<F>(callback)]() mutable {
+					callback(make_error_code(ErrorCode::MessageTooLarge), std::size_t(0));
+				});
+			}
+
+		private:
+			std::array<asio::const_buffer, ASYNC_IO_MAX_BUFFERS> m_buffers;
+		};
+
+		// Memory asio allocates its operations from, instead of the heap.
+		// Asks that don't fit a block, or come when every block is taken, still go to the heap.
+		class ASIOHandlerArena {
+		public:
+			ASIOHandlerArena() = default;
+			ASIOHandlerArena(ASIOHandlerArena const&) = delete;
+			ASIOHandlerArena& operator=(ASIOHandlerArena const&) = delete;
+
+			void* allocate(std::size_t size) {
+				if (size <= ASIO_HANDLER_ARENA_BLOCK_SIZE) {
+					uint32_t used = m_used.load(std::memory_order_relaxed);
+					for (size_t i = 0; i < ASIO_HANDLER_ARENA_BLOCKS; ++i) {
+						uint32_t bit = uint32_t(1) << i;
+						if (!(used & bit)) {
+							used = m_used.fetch_or(bit, std::memory_order_acquire);
+							if (!(used & bit)) {
+								return m_blocks[i];
+							}
+						}
+					}
+				}
+				return ::operator new(size);
+			}
+
+			void deallocate(void* ptr) {
+				auto* block = static_cast<unsigned char*>(ptr);
+				if (block >= m_blocks[0] && block < m_blocks[0] + sizeof(m_blocks)) {
+					size_t i = (block - m_blocks[0]) / ASIO_HANDLER_ARENA_BLOCK_SIZE;
+					m_used.fetch_and(~(uint32_t(1) << i), std::memory_order_release);
+				}
+				else {
+					::operator delete(ptr);
+				}
+			}
+
+		private:
+			static_assert(ASIO_HANDLER_ARENA_BLOCKS <= 32);
+
+			alignas(std::max_align_t) unsigned char m_blocks[ASIO_HANDLER_ARENA_BLOCKS][ASIO_HANDLER_ARENA_BLOCK_SIZE];
+			std::atomic<uint32_t> m_used{ 0 };
+		};
+
+		template <class T>
+		struct ASIOHandlerAllocator {
+			using value_type = T;
+
+			explicit ASIOHandlerAllocator(ASIOHandlerArena& arena)
+				: m_arena(&arena)
+			{}
+
+			template <class U>
+			ASIOHandlerAllocator(ASIOHandlerAllocator<U> const& other)
+				: m_arena(other.m_arena)
+			{}
+
+			T* allocate(std::size_t count) {
+				return static_cast<T*>(m_arena->allocate(sizeof(T) * count));
+			}
+
+			void deallocate(T* ptr, std::size_t) {
+				m_arena->deallocate(ptr);
+			}
+
+			template <class U>
+			bool operator==(ASIOHandlerAllocator<U> const& other) const {
+				return m_arena == other.m_arena;
+			}
+
+			template <class U>
+			bool operator!=(ASIOHandlerAllocator<U> const& other) const {
+				return m_arena != other.m_arena;
+			}
+
+			ASIOHandlerArena* m_arena;
+		};
+
+		// a handler whose associated allocator is the arena, so asio puts the operation holding it there
+		template <class F>
+		struct ASIOArenaHandler {
+			using allocator_type = ASIOHandlerAllocator<void>;
+
+			allocator_type get_allocator() const noexcept {
+				return allocator_type(*arena);
+			}
+
+			template <class... Args>
+			void operator()(Args&&... args) {
+				handler(std::forward<Args>(args)...);
+			}
+
+			F handler;
+			ASIOHandlerArena* arena;
+		};
+
+		template <class F>
+		ASIOArenaHandler<std::decay_t<F>> bind_arena(ASIOHandlerArena& arena, F&& handler) {
+			return { std::forward<F>(handler), &arena };
+		}
+
 		template <class T, typename = std::enable_if_t<is_asio_socket_v<T>>>
 		struct ASIOAsyncSocketBase {
 			
@@ -34,12 +178,24 @@ namespace xpo {
 				: m_socket(std::move(socket))
 			{}
 
-			void read_async(uint8_t* const buffer, std::size_t count, std::function<void(std::error_code, std::size_t)> callback) override {
-				asio::async_read(this->m_socket, asio::buffer(buffer, count), callback);
+			void read_async(uint8_t* const buffer, std::size_t count, IOCallback callback) override {
+				asio::async_read(this->m_socket, asio::buffer(buffer, count), bind_arena(m_arena, std::move(callback)));
+			}
+
+			void read_some_async(uint8_t* const buffer, std::size_t count, IOCallback callback) override {
+				m_socket.async_read_some(asio::buffer(buffer, count), bind_arena(m_arena, std::move(callback)));
+			}
+
+			void write_async(uint8_t* const buffer, std::size_t count, IOCallback callback) override {
+				asio::async_write(this->m_socket, asio::buffer(buffer, count), bind_arena(m_arena, std::move(callback)));
 			}
 
-			void write_async(uint8_t* const buffer, std::size_t count, std::function<void(std::error_code, std::size_t)> callback) override {
-				asio::async_write(this->m_socket, asio::buffer(buffer, count), callback);
+			void write_async(std::span<ConstByteBuffer const> buffers, IOCallback callback) override {
+				if (!ASIOGatherBuffers::fits(buffers)) {
+					ASIOGatherBuffers::reject(m_socket.get_executor(), std::move(callback));
+					return;
+				}
+				asio::async_write(this->m_socket, m_gatherBuffers.map(buffers), bind_arena(m_arena, std::move(callback)));
 			}
 
 			asio::ip::tcp::endpoint const& remote_endpoint() const {
@@ -48,6 +204,8 @@ namespace xpo {
 
 		protected:
 			ASIO_TCP m_socket;
+			ASIOGatherBuffers m_gatherBuffers;
+			ASIOHandlerArena m_arena;
 		};
 
 		template <>
@@ -56,12 +214,25 @@ namespace xpo {
 				: m_socket(socket)
 			{}
 
-			void read_async(uint8_t* const buffer, std::size_t count, std::function<void(std::error_code, std::size_t)> callback) override {
-				m_socket.async_receive_from(asio::buffer(buffer, count), m_remoteInEndPoint, callback);
+			void read_async(uint8_t* const buffer, std::size_t count, IOCallback callback) override {
+				m_socket.async_receive_from(asio::buffer(buffer, count), m_remoteInEndPoint, bind_arena(m_arena, std::move(callback)));
 			}
 
-			void write_async(uint8_t* const buffer, std::size_t count, std::function<void(std::error_code, std::size_t)> callback) override {
-				m_socket.async_send_to(asio::buffer(buffer, count), m_remoteOutEndPoint, callback);
+			// every datagram is a whole message already
+			void read_some_async(uint8_t* const buffer, std::size_t count, IOCallback callback) override {
+				read_async(buffer, count, std::move(callback));
+			}
+
+			void write_async(uint8_t* const buffer, std::size_t count, IOCallback callback) override {
+				m_socket.async_send_to(asio::buffer(buffer, count), m_remoteOutEndPoint, bind_arena(m_arena, std::move(callback)));
+			}
+
+			void write_async(std::span<ConstByteBuffer const> buffers, IOCallback callback) override {
+				if (!ASIOGatherBuffers::fits(buffers)) {
+					ASIOGatherBuffers::reject(m_socket.get_executor(), std::move(callback));
+					return;
+				}
+				m_socket.async_send_to(m_gatherBuffers.map(buffers), m_remoteOutEndPoint, bind_arena(m_arena, std::move(callback)));
 			}
 
 			asio::ip::udp::endpoint const& remote_endpoint() const {
@@ -72,14 +243,16 @@ namespace xpo {
 			asio::ip::udp::endpoint m_remoteInEndPoint;
 			asio::ip::udp::endpoint m_remoteOutEndPoint;
 			ASIO_UDP& m_socket;
+			ASIOGatherBuffers m_gatherBuffers;
+			ASIOHandlerArena m_arena;
 		};
 
 		template <class T, typename = std::enable_if_t<is_asio_socket_v<T>>>
 		struct ASIOAsyncSocket : public ASIOAsyncSocketBase<T> {
 			using ASIOAsyncSocketBase<T>::ASIOAsyncSocketBase;
 
-			void execute_async(std::function<void()> f) override {
-				asio::post(this->m_socket.get_executor(), f);
+			void execute_async(IOTask f) override {
+				asio::post(this->m_socket.get_executor(), std::move(f));
 			}
 
 			void close() override {
@@ -95,6 +268,60 @@ namespace xpo {
 			}
 		};
 
+		// ASIOAsyncTCPSocket without the virtual interface, see IStaticAsyncByteIO.
+		// handlers go to asio as they are, so the whole completion path can be inlined.
+		struct ASIOStaticTCPSocket {
+			ASIOStaticTCPSocket(ASIO_TCP& socket)
+				: m_socket(std::move(socket))
+			{}
+
+			template <class F>
+			void execute_async(F&& f) {
+				asio::post(m_socket.get_executor(), std::forward<F>(f));
+			}
+
+			template <class F>
+			void read_async(uint8_t* const buffer, std::size_t count, F&& callback) {
+				asio::async_read(m_socket, asio::buffer(buffer, count), bind_arena(m_arena, std::forward<F>(callback)));
+			}
+
+			template <class F>
+			void read_some_async(uint8_t* const buffer, std::size_t count, F&& callback) {
+				m_socket.async_read_some(asio::buffer(buffer, count), bind_arena(m_arena, std::forward<F>(callback)));
+			}
+
+			template <class F>
+			void write_async(uint8_t* const buffer, std::size_t count, F&& callback) {
+				asio::async_write(m_socket, asio::buffer(buffer, count), bind_arena(m_arena, std::forward<F>(callback)));
+			}
+
+			template <class F>
+			void write_async(std::span<ConstByteBuffer const> buffers, F&& callback) {
+				if (!ASIOGatherBuffers::fits(buffers)) {
+					ASIOGatherBuffers::reject(m_socket.get_executor(), std::forward<F>(callback));
+					return;
+				}
+				asio::async_write(m_socket, m_gatherBuffers.map(buffers), bind_arena(m_arena, std::forward<F>(callback)));
+			}
+
+			void close() {
+				m_socket.close();
+			}
+
+			bool is_open() {
+				return m_socket.is_open();
+			}
+
+			ASIO_TCP& socket() {
+				return m_socket;
+			}
+
+		protected:
+			ASIO_TCP m_socket;
+			ASIOGatherBuffers m_gatherBuffers;
+			ASIOHandlerArena m_arena;
+		};
+
 		using ASIOAsyncTCPSocket = ASIOAsyncSocket<ASIO_TCP>;
 		using ASIOAsyncUDPSocket = ASIOAsyncSocket<ASIO_UDP>;
 	}
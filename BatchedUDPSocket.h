@@ -0,0 +1,206 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <span>
+#include <system_error>
+
+#include <asio/ts/net.hpp>
+
+#include "./ASIOSocket.h"
+#include "./Errors.h"
+#include "./IAsyncIO.h"
+
+#if defined(__linux__)
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#endif
+
+#ifndef BATCHED_UDP_MAX_DATAGRAMS
+#define BATCHED_UDP_MAX_DATAGRAMS 32
+#endif
+
+namespace xpo {
+	namespace net {
+		// a datagram to receive into, size and endpoint are filled in once it arrives
+		struct DatagramIn {
+			uint8_t* data;
+			std::size_t capacity;
+			std::size_t size;
+			asio::ip::udp::endpoint endpoint;
+		};
+
+		// a datagram to send, gathered from its buffers
+		struct DatagramOut {
+			asio::ip::udp::endpoint endpoint;
+			std::span<ConstByteBuffer const> buffers;
+		};
+
+		// how many of the datagrams, from the front, have all their buffers fit into `vectors` iovecs.
+		// a datagram is never sent with only some of its buffers, the batch stops before it instead.
+		inline std::size_t datagrams_fitting(std::span<DatagramOut const> datagrams, std::size_t vectors) {
+			std::size_t count = 0;
+			std::size_t used = 0;
+			while (count < datagrams.size() && used + datagrams[count].buffers.size() <= vectors) {
+				used += datagrams[count++].buffers.size();
+			}
+			return count;
+		}
+
+		// datagram io that moves many datagrams per operation, each with its own endpoint.
+		// the callbacks get the number of datagrams received or sent.
+		template <class T>
+		concept IBatchedDatagramIO = requires (T io, std::span<DatagramIn> in, std::span<DatagramOut const> out, IOCallback callback) {
+			io.read_batch_async(in, std::move(callback));
+			io.write_batch_async(out, std::move(callback));
+		};
+
+#if defined(__linux__)
+		// UDP socket moving up to BATCHED_UDP_MAX_DATAGRAMS datagrams per recvmmsg/sendmmsg call.
+		// asio only tells us when the socket is ready, the syscalls are made directly on the native handle.
+		struct ASIOBatchedUDPSocket : public ASIOAsyncSocket<ASIO_UDP> {
+			using ASIOAsyncSocket<ASIO_UDP>::ASIOAsyncSocket;
+
+			void read_batch_async(std::span<DatagramIn> datagrams, IOCallback callback) {
+				// kept here rather than captured, so the wait handler is only `this`
+				m_readDatagrams = datagrams;
+				m_readCallback = std::move(callback);
+				wait_read();
+			}
+
+			// sends as many datagrams as fit into the iovecs, the callback gets how many that were
+			void write_batch_async(std::span<DatagramOut const> datagrams, IOCallback callback) {
+				datagrams = datagrams.first(std::min<size_t>(datagrams.size(), BATCHED_UDP_MAX_DATAGRAMS));
+				size_t count = datagrams_fitting(datagrams, m_outVectors.size());
+				if (count == 0 && !datagrams.empty()) {
+					// the first datagram alone has more buffers than we can gather
+					m_sendCallback = std::move(callback);
+					complete_send_async(make_error_code(ErrorCode::MessageTooLarge), 0);
+					return;
+				}
+
+				size_t vectorCount = 0;
+				for (size_t i = 0; i < count; ++i) {
+					size_t buffers = datagrams[i].buffers.size();
+					for (size_t j = 0; j < buffers; ++j) {
+						m_outVectors[vectorCount + j] = { const_cast<uint8_t*>(datagrams[i].buffers[j].data), datagrams[i].buffers[j].size };
+					}
+					m_outHeaders[i] = {};
+					m_outHeaders[i].msg_hdr.msg_name = const_cast<sockaddr*>(datagrams[i].endpoint.data());
+					m_outHeaders[i].msg_hdr.msg_namelen = static_cast<socklen_t>(datagrams[i].endpoint.size());
+					m_outHeaders[i].msg_hdr.msg_iov = &m_outVectors[vectorCount];
+					m_outHeaders[i].msg_hdr.msg_iovlen = buffers;
+					vectorCount += buffers;
+				}
+				m_sendCallback = std::move(callback);
+				m_sendCount = count;
+				send_batch_async(0);
+			}
+
+		protected:
+			void wait_read() {
+				m_socket.async_wait(asio::socket_base::wait_read, bind_arena(m_arena, [this](std::error_code ec) {
+					if (ec) {
+						finish_read(ec, 0);
+						return;
+					}
+
+					size_t count = std::min<size_t>(m_readDatagrams.size(), BATCHED_UDP_MAX_DATAGRAMS);
+					for (size_t i = 0; i < count; ++i) {
+						m_inVectors[i] = { m_readDatagrams[i].data, m_readDatagrams[i].capacity };
+						m_inHeaders[i] = {};
+						m_inHeaders[i].msg_hdr.msg_name = m_readDatagrams[i].endpoint.data();
+						m_inHeaders[i].msg_hdr.msg_namelen = static_cast<socklen_t>(m_readDatagrams[i].endpoint.capacity());
+						m_inHeaders[i].msg_hdr.msg_iov = &m_inVectors[i];
+						m_inHeaders[i].msg_hdr.msg_iovlen = 1;
+					}
+
+					int received = ::recvmmsg(m_socket.native_handle(), m_inHeaders.data(), static_cast<unsigned int>(count), MSG_DONTWAIT, nullptr);
+					if (received < 0) {
+						if (errno == EAGAIN || errno == EWOULDBLOCK) {
+							// someone else drained it, wait again
+							wait_read();
+						}
+						else {
+							finish_read(std::error_code(errno, std::system_category()), 0);
+						}
+						return;
+					}
+
+					size_t kept = 0;
+					for (int i = 0; i < received; ++i) {
+						// datagrams larger than their buffer are dropped, the kept ones move to the front
+						if (m_inHeaders[i].msg_hdr.msg_flags & MSG_TRUNC) {
+							continue;
+						}
+						m_readDatagrams[i].size = m_inHeaders[i].msg_len;
+						m_readDatagrams[i].endpoint.resize(m_inHeaders[i].msg_hdr.msg_namelen);
+						std::swap(m_readDatagrams[kept++], m_readDatagrams[i]);
+					}
+					if (kept == 0) {
+						wait_read();
+						return;
+					}
+					m_remoteInEndPoint = m_readDatagrams[kept - 1].endpoint;
+					finish_read({}, kept);
+				}));
+			}
+
+			void finish_read(std::error_code ec, size_t count) {
+				auto callback = std::move(m_readCallback);
+				m_readCallback = nullptr;
+				callback(ec, count);
+			}
+
+			// sends the prepared headers from `sent` on, waiting for the socket whenever it is full
+			void send_batch_async(size_t sent) {
+				while (sent < m_sendCount) {
+					int result = ::sendmmsg(m_socket.native_handle(), m_outHeaders.data() + sent, static_cast<unsigned int>(m_sendCount - sent), MSG_DONTWAIT);
+					if (result < 0) {
+						if (errno == EAGAIN || errno == EWOULDBLOCK) {
+							m_socket.async_wait(asio::socket_base::wait_write, bind_arena(m_arena, [this, sent](std::error_code ec) {
+								if (ec) {
+									finish_send(ec, sent);
+								}
+								else {
+									send_batch_async(sent);
+								}
+							}));
+						}
+						else {
+							complete_send_async(std::error_code(errno, std::system_category()), sent);
+						}
+						return;
+					}
+					sent += result;
+				}
+				complete_send_async({}, sent);
+			}
+
+			// never complete inline, the callback usually starts the next send
+			void complete_send_async(std::error_code ec, size_t count) {
+				asio::post(m_socket.get_executor(), [this, ec, count]() {
+					finish_send(ec, count);
+				});
+			}
+
+			void finish_send(std::error_code ec, size_t count) {
+				auto callback = std::move(m_sendCallback);
+				m_sendCallback = nullptr;
+				callback(ec, count);
+			}
+
+			std::array<mmsghdr, BATCHED_UDP_MAX_DATAGRAMS> m_inHeaders;
+			std::array<iovec, BATCHED_UDP_MAX_DATAGRAMS> m_inVectors;
+			std::array<mmsghdr, BATCHED_UDP_MAX_DATAGRAMS> m_outHeaders;
+			std::array<iovec, ASYNC_IO_MAX_BUFFERS> m_outVectors;
+
+			std::span<DatagramIn> m_readDatagrams;
+			IOCallback m_readCallback;
+			size_t m_sendCount = 0;
+			IOCallback m_sendCallback;
+		};
+#endif
+	}
+}
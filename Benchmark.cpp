@@ -0,0 +1,204 @@
+// Receive pipeline benchmark: virtual TCPConnection against StaticTCPConnection.
+// Both are fed the same in-memory stream of messages with a 12 byte body, so
+// only the framing, dispatch and callback cost is measured.
+// Excluded from the default build because it has its own main, build it on its own, e.g.
+//   g++ -std=c++20 -O2 -I<asio>/include Benchmark.cpp -o benchmark -pthread
+#ifdef _WIN32
+#define _WIN32_WINNT 0x0A00
+#endif
+
+#define ASIO_STANDALONE
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include <asio/ts/net.hpp>
+
+#include "Message.h"
+#include "MessageStream.h"
+#include "Connection.h"
+#include "StaticConnection.h"
+
+using namespace xpo::net;
+
+#ifndef BENCHMARK_MESSAGES
+// distinct messages in the replayed stream
+#define BENCHMARK_MESSAGES 1000
+#endif
+
+#ifndef BENCHMARK_READS
+// completed reads per run
+#define BENCHMARK_READS 2000000
+#endif
+
+#ifndef BENCHMARK_CHUNK
+// upper bound for a single read_some, roughly one datagram worth
+#define BENCHMARK_CHUNK 1400
+#endif
+
+enum class Commands {
+	Tick = 1
+};
+
+using BenchMessage = Message<Commands>;
+
+// serves the encoded stream cyclically, never more than BENCHMARK_CHUNK bytes per read
+struct StreamFeed {
+	std::vector<uint8_t> const& stream;
+	size_t position = 0;
+
+	size_t fill(uint8_t* buffer, size_t count) {
+		count = std::min<size_t>(count, BENCHMARK_CHUNK);
+		size_t available = std::min(count, stream.size() - position);
+		std::memcpy(buffer, stream.data() + position, available);
+		if (available < count) {
+			std::memcpy(buffer + available, stream.data(), count - available);
+		}
+		position = (position + count) % stream.size();
+		return count;
+	}
+};
+
+// completes reads synchronously from the feed, one pending read at a time
+template <class Callback>
+struct PendingRead {
+	Callback callback;
+	uint8_t* buffer = nullptr;
+	size_t count = 0;
+	bool some = false;
+
+	void complete(StreamFeed& feed) {
+		size_t read = 0;
+		if (some) {
+			read = feed.fill(buffer, count);
+		}
+		else {
+			while (read < count) {
+				read += feed.fill(buffer + read, count - read);
+			}
+		}
+		auto callback = std::move(this->callback);
+		callback(std::error_code(), read);
+	}
+};
+
+struct VirtualStreamIO : public IAsyncByteIO {
+	VirtualStreamIO(std::vector<uint8_t> const& stream)
+		: m_feed{ stream }
+	{}
+
+	void execute_async(IOTask task) override { task(); }
+	void read_async(uint8_t* buffer, size_t count, IOCallback callback) override {
+		m_read = { std::move(callback), buffer, count, false };
+	}
+	void read_some_async(uint8_t* buffer, size_t count, IOCallback callback) override {
+		m_read = { std::move(callback), buffer, count, true };
+	}
+	void write_async(uint8_t*, size_t count, IOCallback callback) override { callback(std::error_code(), count); }
+	void write_async(std::span<ConstByteBuffer const>, IOCallback callback) override { callback(std::error_code(), 0); }
+	void close() override {}
+	bool is_open() override { return true; }
+
+	void step() { m_read.complete(m_feed); }
+
+private:
+	StreamFeed m_feed;
+	PendingRead<IOCallback> m_read;
+};
+
+struct StaticStreamIO {
+	using Callback = InplaceFunction<void(std::error_code, size_t), 32>;
+
+	StaticStreamIO(std::vector<uint8_t> const& stream)
+		: m_feed{ stream }
+	{}
+
+	template <class F>
+	void execute_async(F&& task) { task(); }
+	template <class F>
+	void read_async(uint8_t* buffer, size_t count, F&& callback) {
+		m_read = { Callback(std::forward<F>(callback)), buffer, count, false };
+	}
+	template <class F>
+	void read_some_async(uint8_t* buffer, size_t count, F&& callback) {
+		m_read = { Callback(std::forward<F>(callback)), buffer, count, true };
+	}
+	template <class F>
+	void write_async(std::span<ConstByteBuffer const>, F&& callback) { callback(std::error_code(), 0); }
+	void close() {}
+	bool is_open() { return true; }
+
+	void step() { m_read.complete(m_feed); }
+
+private:
+	StreamFeed m_feed;
+	PendingRead<Callback> m_read;
+};
+
+struct VirtualConnection : public TCPConnection<BenchMessage, VirtualStreamIO> {
+	using TCPConnection<BenchMessage, VirtualStreamIO>::TCPConnection;
+
+	uint64_t received = 0;
+	uint64_t checksum = 0;
+
+	void on_receive(BenchMessage& msg) override {
+		received++;
+		checksum += msg.m_body[0];
+	}
+	bool on_receive_header(BenchMessage::header_type& header) override { return header.size() <= 1024; }
+	void on_send(BenchMessage&) override {}
+	bool on_receive_fail(std::error_code) override { return true; }
+};
+
+struct StaticConnection : public StaticTCPConnection<StaticConnection, BenchMessage, StaticStreamIO> {
+	using StaticTCPConnection<StaticConnection, BenchMessage, StaticStreamIO>::StaticTCPConnection;
+
+	uint64_t received = 0;
+	uint64_t checksum = 0;
+
+	void on_receive(BenchMessage& msg) {
+		received++;
+		checksum += msg.m_body[0];
+	}
+};
+
+template <class ConnectionT>
+void run(char const* name, std::vector<uint8_t> const& stream) {
+	ConnectionT connection(stream);
+	connection.listen_for_messages();
+
+	auto start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < BENCHMARK_READS; i++) {
+		connection.step();
+	}
+	std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+
+	std::printf("%s: %llu msgs, %.1f ns/msg (checksum %llu)\n", name,
+		(unsigned long long)connection.received, elapsed.count() / connection.received,
+		(unsigned long long)connection.checksum);
+}
+
+int main() {
+	using Codec = HeaderCodec<BenchMessage::header_type>;
+
+	std::vector<uint8_t> stream;
+	for (int i = 0; i < BENCHMARK_MESSAGES; i++) {
+		BenchMessage msg;
+		msg.header.m_id = Commands::Tick;
+		MessageWriter writer(msg);
+		writer << i << uint32_t(7) << uint32_t(i * 3);
+
+		uint8_t header[Codec::max_size];
+		size_t headerSize = Codec::encode(msg.header, header);
+		stream.insert(stream.end(), header, header + headerSize);
+		stream.insert(stream.end(), msg.m_body.begin(), msg.m_body.end());
+	}
+
+	for (int round = 0; round < 5; round++) {
+		run<VirtualConnection>("virtual", stream);
+		run<StaticConnection>("static ", stream);
+	}
+	return 0;
+}
@@ -0,0 +1,193 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cassert>
+#include <cmath>
+#include <span>
+#include <stdint.h>
+
+#include "./Message.h"
+#include "./MessageStream.h"
+
+
+namespace xpo {
+	namespace net {
+		// Bit packed payloads.
+		//
+		// Values take only the bits they need: bools take one bit, an int in [min, max] takes
+		// bits_required(max - min) bits and a float is quantized to a precision within its bounds.
+		// Bits are packed least significant first and flushed as whole bytes in order, so the layout
+		// doesn't depend on the platform's byte order.
+		//
+		// A BitWriter appends to the end of a message body, so bit packed sections can be mixed with
+		// MessageWriter fields as long as each BitWriter is flushed (or destroyed) before the next write.
+		// Read them back in the same order with a BitReader.
+
+		constexpr unsigned bits_required(uint32_t range) {
+			return static_cast<unsigned>(std::bit_width(range));
+		}
+
+		// the amount of steps a float in [min, max] is quantized to. the steps have to fit in 32 bits.
+		inline uint32_t quantized_steps(float min, float max, float precision) {
+			assert(precision > 0.0f && max >= min && "quantized_steps() needs a positive precision and min <= max");
+			float steps = std::ceil((max - min) / precision);
+			assert(double(steps) <= double(UINT32_MAX) && "too many steps for 32 bits, use a coarser precision");
+			return static_cast<uint32_t>(steps);
+		}
+
+		template <IMessageHeader H, class B>
+		class BitWriter {
+		public:
+			BitWriter(MessageBase<H, B>& msg)
+				: m_msg(msg)
+			{}
+
+			BitWriter(BitWriter const&) = delete;
+
+			~BitWriter() {
+				flush();
+			}
+
+			// writes the low `bits` bits of `value`, up to 32
+			void write_bits(uint32_t value, unsigned bits) {
+				if (bits == 0) {
+					return;
+				}
+				uint64_t mask = (uint64_t(1) << bits) - 1;
+				m_scratch |= (uint64_t(value) & mask) << m_scratchBits;
+				m_scratchBits += bits;
+				if (m_scratchBits >= 32) {
+					emit(4);
+				}
+			}
+
+			void write_bool(bool value) {
+				write_bits(value ? 1 : 0, 1);
+			}
+
+			// `value` is clamped to [min, max]
+			void write_ranged(int32_t value, int32_t min, int32_t max) {
+				value = std::clamp(value, min, max);
+				uint32_t range = static_cast<uint32_t>(int64_t(max) - min);
+				write_bits(static_cast<uint32_t>(int64_t(value) - min), bits_required(range));
+			}
+
+			// `value` is clamped to [min, max] and rounded to the nearest multiple of `precision` from `min`
+			void write_quantized(float value, float min, float max, float precision) {
+				uint32_t steps = quantized_steps(min, max, precision);
+				float clamped = std::clamp(value, min, max);
+				uint32_t step = std::min(static_cast<uint32_t>(std::lround((clamped - min) / precision)), steps);
+				write_bits(step, bits_required(steps));
+			}
+
+			// pads the last byte with zero bits and appends everything that's left to the body
+			void flush() {
+				if (m_scratchBits > 0) {
+					emit((m_scratchBits + 7) / 8);
+				}
+			}
+
+		private:
+			void emit(size_t bytes) {
+				size_t i = m_msg.m_body.size();
+				m_msg.m_body.resize(i + bytes);
+				uint8_t* out = m_msg.m_body.data() + i;
+				for (size_t b = 0; b < bytes; ++b) {
+					out[b] = static_cast<uint8_t>(m_scratch);
+					m_scratch >>= 8;
+				}
+				m_scratchBits = m_scratchBits > bytes * 8 ? m_scratchBits - static_cast<unsigned>(bytes * 8) : 0;
+				m_msg.header.m_size = m_msg.m_body.size();
+			}
+
+		private:
+			MessageBase<H, B>& m_msg;
+			uint64_t m_scratch = 0;
+			unsigned m_scratchBits = 0;
+		};
+
+		class BitReader {
+		public:
+			BitReader(std::span<const uint8_t> data)
+				: m_data(data)
+			{}
+
+			// reads from where `reader` stands, and moves it past the bytes this reader consumed when finished
+			BitReader(MessageReader& reader)
+				: m_data(reader.remaining_bytes())
+				, m_reader(&reader)
+			{
+				m_ok = reader.ok();
+			}
+
+			BitReader(BitReader const&) = delete;
+
+			~BitReader() {
+				finish();
+			}
+
+			uint32_t read_bits(unsigned bits) {
+				if (!m_ok || m_bitPosition + bits > m_data.size() * 8) {
+					m_ok = false;
+					return 0;
+				}
+				uint32_t value = 0;
+				unsigned done = 0;
+				while (done < bits) {
+					unsigned offset = m_bitPosition & 7;
+					unsigned take = std::min(8 - offset, bits - done);
+					uint32_t chunk = (m_data[m_bitPosition >> 3] >> offset) & ((1u << take) - 1);
+					value |= chunk << done;
+					done += take;
+					m_bitPosition += take;
+				}
+				return value;
+			}
+
+			bool read_bool() {
+				return read_bits(1) != 0;
+			}
+
+			int32_t read_ranged(int32_t min, int32_t max) {
+				uint32_t range = static_cast<uint32_t>(int64_t(max) - min);
+				int64_t value = int64_t(min) + read_bits(bits_required(range));
+				return static_cast<int32_t>(std::min<int64_t>(value, max));
+			}
+
+			float read_quantized(float min, float max, float precision) {
+				uint32_t steps = quantized_steps(min, max, precision);
+				uint32_t step = read_bits(bits_required(steps));
+				return std::min(min + step * precision, max);
+			}
+
+			// skips the padding of the last byte and moves the attached MessageReader past everything read
+			void finish() {
+				if (m_reader != nullptr) {
+					size_t bytes = (m_bitPosition + 7) / 8;
+					if (m_ok) {
+						m_reader->skip(bytes);
+					}
+					else {
+						m_reader->fail();
+					}
+					m_reader = nullptr;
+				}
+			}
+
+			bool ok() const {
+				return m_ok;
+			}
+
+			explicit operator bool() const {
+				return m_ok;
+			}
+
+		private:
+			std::span<const uint8_t> m_data;
+			size_t m_bitPosition = 0;
+			MessageReader* m_reader = nullptr;
+			bool m_ok = true;
+		};
+	}
+}
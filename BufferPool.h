@@ -0,0 +1,213 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <mutex>
+#include <new>
+#include <stdint.h>
+
+#ifndef BUFFER_POOL_SIZE_CLASSES
+#define BUFFER_POOL_SIZE_CLASSES 64, 256, 1024, 4096
+#endif
+
+// how many free blocks of each size class a thread keeps before handing half of them back to the shared pool
+#ifndef BUFFER_POOL_THREAD_CACHE_SIZE
+#define BUFFER_POOL_THREAD_CACHE_SIZE 256
+#endif
+
+// how many free blocks of each size class the shared pool keeps before releasing them to the allocator
+#ifndef BUFFER_POOL_SHARED_CACHE_SIZE
+#define BUFFER_POOL_SHARED_CACHE_SIZE 4096
+#endif
+
+
+namespace xpo {
+	namespace net {
+		// Recycles fixed size blocks so that message bodies stop hitting the allocator once the pool is warm.
+		// Every thread owns a freelist per size class. Blocks freed on a different thread than the one that
+		// allocated them (e.g. receive thread -> game loop) flow back through a shared freelist in batches,
+		// so the shared lock is taken once per half a thread cache, not once per block.
+		// Requests larger than the biggest size class go straight to the allocator.
+		template <std::size_t... SizeClasses>
+		class BufferPool {
+			static_assert(sizeof...(SizeClasses) > 0, "BufferPool needs at least one size class");
+
+			static constexpr std::size_t const CLASS_COUNT = sizeof...(SizeClasses);
+			static constexpr std::array<std::size_t, CLASS_COUNT> const CLASS_SIZES = { SizeClasses... };
+			static constexpr std::size_t const THREAD_CACHE_SIZE = BUFFER_POOL_THREAD_CACHE_SIZE;
+			static constexpr std::size_t const SHARED_CACHE_SIZE = BUFFER_POOL_SHARED_CACHE_SIZE;
+			static constexpr std::size_t const BATCH_SIZE = std::max<std::size_t>(THREAD_CACHE_SIZE / 2, 1);
+
+			struct Block {
+				Block* next;
+			};
+
+			struct FreeList {
+				Block* head = nullptr;
+				std::size_t count = 0;
+
+				void push(Block* block) {
+					block->next = head;
+					head = block;
+					++count;
+				}
+
+				Block* pop() {
+					Block* block = head;
+					head = block->next;
+					--count;
+					return block;
+				}
+
+				void release() {
+					while (head != nullptr) {
+						::operator delete(pop());
+					}
+				}
+			};
+
+			struct SharedCache {
+				std::mutex mutex[CLASS_COUNT];
+				FreeList lists[CLASS_COUNT];
+
+				~SharedCache() {
+					for (FreeList& list : lists) {
+						list.release();
+					}
+				}
+			};
+
+			struct ThreadCache {
+				FreeList lists[CLASS_COUNT];
+
+				~ThreadCache() {
+					// give everything back so other threads can reuse it
+					for (std::size_t i = 0; i < CLASS_COUNT; ++i) {
+						while (lists[i].count > 0) {
+							give_back(i, lists[i], lists[i].count);
+						}
+					}
+				}
+			};
+
+		public:
+			static constexpr std::size_t max_pooled_size() {
+				return CLASS_SIZES[CLASS_COUNT - 1];
+			}
+
+			static void* allocate(std::size_t size) {
+				std::size_t i = class_index(size);
+				if (i == CLASS_COUNT) {
+					return ::operator new(size);
+				}
+
+				FreeList& local = thread_cache().lists[i];
+				if (local.count == 0) {
+					take_from_shared(i, local);
+					if (local.count == 0) {
+						// the pool is still warming up
+						return ::operator new(CLASS_SIZES[i]);
+					}
+				}
+				return local.pop();
+			}
+
+			static void deallocate(void* ptr, std::size_t size) {
+				if (ptr == nullptr) {
+					return;
+				}
+
+				std::size_t i = class_index(size);
+				if (i == CLASS_COUNT) {
+					::operator delete(ptr);
+					return;
+				}
+
+				FreeList& local = thread_cache().lists[i];
+				local.push(static_cast<Block*>(ptr));
+				if (local.count > THREAD_CACHE_SIZE) {
+					give_back(i, local, BATCH_SIZE);
+				}
+			}
+
+		private:
+			static constexpr std::size_t class_index(std::size_t size) {
+				for (std::size_t i = 0; i < CLASS_COUNT; ++i) {
+					if (size <= CLASS_SIZES[i]) {
+						return i;
+					}
+				}
+				return CLASS_COUNT;
+			}
+
+			static SharedCache& shared_cache() {
+				static SharedCache cache;
+				return cache;
+			}
+
+			static ThreadCache& thread_cache() {
+				static thread_local ThreadCache cache;
+				return cache;
+			}
+
+			static void take_from_shared(std::size_t i, FreeList& local) {
+				SharedCache& shared = shared_cache();
+				std::scoped_lock lock(shared.mutex[i]);
+				for (std::size_t n = 0; n < BATCH_SIZE && shared.lists[i].count > 0; ++n) {
+					local.push(shared.lists[i].pop());
+				}
+			}
+
+			static void give_back(std::size_t i, FreeList& local, std::size_t count) {
+				SharedCache& shared = shared_cache();
+				std::scoped_lock lock(shared.mutex[i]);
+				for (std::size_t n = 0; n < count && local.count > 0; ++n) {
+					if (shared.lists[i].count < SHARED_CACHE_SIZE) {
+						shared.lists[i].push(local.pop());
+					}
+					else {
+						::operator delete(local.pop());
+					}
+				}
+			}
+
+			static_assert(((SizeClasses >= sizeof(Block)) && ...), "Size classes must be able to hold a pointer");
+		};
+
+		using DefaultBufferPool = BufferPool<BUFFER_POOL_SIZE_CLASSES>;
+
+		// std compatible allocator on top of a BufferPool, used as the allocator of pooled message bodies
+		template <class T, class Pool = DefaultBufferPool>
+		struct PoolAllocator {
+			using value_type = T;
+
+			PoolAllocator() noexcept = default;
+
+			template <class U>
+			PoolAllocator(PoolAllocator<U, Pool> const&) noexcept {}
+
+			T* allocate(std::size_t n) {
+				return static_cast<T*>(Pool::allocate(n * sizeof(T)));
+			}
+
+			void deallocate(T* ptr, std::size_t n) noexcept {
+				Pool::deallocate(ptr, n * sizeof(T));
+			}
+
+			template <class U>
+			struct rebind {
+				using other = PoolAllocator<U, Pool>;
+			};
+
+			template <class U>
+			bool operator == (PoolAllocator<U, Pool> const&) const noexcept {
+				return true;
+			}
+
+			template <class U>
+			bool operator != (PoolAllocator<U, Pool> const&) const noexcept {
+				return false;
+			}
+		};
+	}
+}
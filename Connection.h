@@ -1,16 +1,49 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cstring>
+#include <memory>
+#include <optional>
+#include <thread>
+#include <vector>
+
+#include <asio/ts/timer.hpp>
+
 #include "./ASIOSocket.h"
+#include "./BatchedUDPSocket.h"
 #include "./Errors.h"
+#include "./Futex.h"
+#include "./HeaderCodec.h"
 #include "./IAsyncIO.h"
 #include "./IMessage.h"
 #include "./IQueue.h"
+#include "./Log.h"
+#include "./Metrics.h"
+#include "./SharedMessage.h"
 #include "./ThreadSafeQueue.h"
 
+#ifndef CONNECTION_TCP_DEFAULT_BUFFER_SIZE
+#define CONNECTION_TCP_DEFAULT_BUFFER_SIZE 4096
+#endif
+
+// messages a connection's out queue holds before its overflow policy kicks in
+#ifndef CONNECTION_DEFAULT_OUT_QUEUE_LIMIT
+#define CONNECTION_DEFAULT_OUT_QUEUE_LIMIT 4096
+#endif
+
 #ifndef CONNECTION_UDP_DEFAULT_BUFFER_SIZE
 #define CONNECTION_UDP_DEFAULT_BUFFER_SIZE 512
 #endif
 
+// how long the first message queued on an idle connection waits for others to share its datagram.
+// 0 sends right away, only coalescing what is already queued.
+#ifndef CONNECTION_UDP_DEFAULT_FLUSH_DEADLINE_US
+#define CONNECTION_UDP_DEFAULT_FLUSH_DEADLINE_US 0
+#endif
+
 
 namespace xpo {
 	namespace net {
@@ -34,19 +67,60 @@ namespace xpo {
 
 			}
 
-			OwnedMessage(T& msg, asio::ip::udp::endpoint const& endPoint)
+			OwnedMessage(T const& msg, asio::ip::udp::endpoint const& endPoint)
 				: T(msg)
 				, m_endPoint(endPoint)
 			{
 
 			}
 
+			OwnedMessage(T&& msg, asio::ip::udp::endpoint const& endPoint)
+				: T(std::move(msg))
+				, m_endPoint(endPoint)
+			{
+
+			}
+
+			// the message itself only carries the header, the bytes come from the shared handle
+			OwnedMessage(SharedMessage<T> const& shared, asio::ip::udp::endpoint const& endPoint)
+				: T()
+				, m_endPoint(endPoint)
+				, m_shared(shared)
+			{
+				this->header = shared.header();
+			}
+
 			asio::ip::udp::endpoint& endpoint() {
 				return m_endPoint;
 			}
 
+			asio::ip::udp::endpoint const& endpoint() const {
+				return m_endPoint;
+			}
+
+			bool is_shared() const {
+				return static_cast<bool>(m_shared);
+			}
+
+			SharedMessage<T> const& shared() const {
+				return m_shared;
+			}
+
 		private:
 			asio::ip::udp::endpoint m_endPoint;
+			SharedMessage<T> m_shared;
+		};
+
+		// not every asio ships std::hash for endpoints
+		struct UDPEndpointHash {
+			size_t operator()(asio::ip::udp::endpoint const& endPoint) const {
+				auto const* bytes = reinterpret_cast<uint8_t const*>(endPoint.data());
+				size_t hash = 14695981039346656037ull;
+				for (size_t i = 0; i < endPoint.size(); ++i) {
+					hash = (hash ^ bytes[i]) * 1099511628211ull;
+				}
+				return hash;
+			}
 		};
 
 		template <IByteMessage T>
@@ -54,29 +128,29 @@ namespace xpo {
 			uint32_t const MAX_MESSAGE_BODY_SIZE = 1024;
 
 			virtual void on_receive(T& msg) {
-				std::cout << "Received: " << msg << std::endl;
+				NET_LOG_DEBUG("Received: ", msg);
 			}
 
 			virtual bool on_receive_header(typename T::header_type& header) {
 				// if the header says the message is too large, just drop it
 				if (header.size() > MAX_MESSAGE_BODY_SIZE) {
-					std::cout << "Message body size was too large: " << header.size() << std::endl;
+					NET_LOG_WARN("Message body size was too large: ", header.size());
 					return false;
 				}
 				return true;
 			}
 
 			virtual void on_send(T& msg) {
-				std::cout << "Sending: " << msg << std::endl;
+				NET_LOG_DEBUG("Sending: ", msg);
 			}
 
 			virtual bool on_receive_fail(std::error_code ec) {
-				std::cout << "Receive Failed: " << ec.message() << std::endl;
+				NET_LOG_WARN("Receive Failed: ", ec);
 				return true;
 			}
 
 			virtual bool on_send_fail(std::error_code ec) {
-				std::cout << "Send Failed: " << ec.message() << std::endl;
+				NET_LOG_WARN("Send Failed: ", ec);
 				return true;
 			}
 		};
@@ -86,33 +160,136 @@ namespace xpo {
 			static inline constexpr size_t const MAX_MESSAGE_BODY_SIZE = 1024;
 
 			virtual void on_send(OwnedMessage<T>& msg) {
-				std::cout << "Sending: " << msg << std::endl;
+				NET_LOG_DEBUG("Sending: ", msg);
 			}
 
 			virtual void on_receive(T& msg) {
-				std::cout << "Received: " << msg << std::endl;
+				NET_LOG_DEBUG("Received: ", msg);
 			}
 
 			virtual bool on_receive_header(typename T::header_type& header) {
 				// if the header says the message is too large, just drop it
 				if (header.size() > MAX_MESSAGE_BODY_SIZE) {
-					std::cout << "Message body size was too large: " << header.size() << std::endl;
+					NET_LOG_WARN("Message body size was too large: ", header.size());
 					return false;
 				}
 				return true;
 			}
 
 			virtual bool on_receive_fail(std::error_code ec) {
-				std::cout << "Receive Failed: " << ec.message() << std::endl;
+				NET_LOG_WARN("Receive Failed: ", ec);
 				return true;
 			}
 
 			virtual bool on_send_fail(std::error_code ec) {
-				std::cout << "Send Failed: " << ec.message() << std::endl;
+				NET_LOG_WARN("Send Failed: ", ec);
 				return true;
 			}
 		};
 
+		// Keeps a connection's out queue bounded.
+		// send_message() calls reserve() on the caller's thread. reserve() looks at the messages queued or on their way
+		// to the queue, tells the caller what its send will come to, and waits for room under OverflowPolicy::Block.
+		// The io thread applies the policy again when it queues the message, that's where DropOldest and Collapse
+		// happen, and it also bounds the messages a connection queues from the io thread itself. The io thread never
+		// waits for itself: under Block it queues past the limit instead. So don't send with Block from a handler.
+		class SendBackpressure {
+		public:
+			size_t limit() const {
+				return m_limit.load(std::memory_order_relaxed);
+			}
+
+			void limit(size_t limit) {
+				m_limit.store(limit, std::memory_order_relaxed);
+				wake_blocked();
+			}
+
+			OverflowPolicy policy() const {
+				return m_policy.load(std::memory_order_relaxed);
+			}
+
+			void policy(OverflowPolicy policy) {
+				m_policy.store(policy, std::memory_order_relaxed);
+				wake_blocked();
+			}
+
+			// messages queued or on their way to the queue
+			size_t pending() const {
+				return m_queued.load(std::memory_order_relaxed) + m_posted.load(std::memory_order_relaxed);
+			}
+
+			// before a message is posted to the io thread. Dropped means it must not be posted.
+			// Collapsed means it will be sent in place of a queued message with its key, or of the oldest queued one
+			// if there is none.
+			PushResult reserve() {
+				PushResult result = PushResult::Queued;
+				if (pending() >= limit()) {
+					switch (policy()) {
+					case OverflowPolicy::Block:
+						wait_for_room();
+						result = PushResult::Waited;
+						break;
+					case OverflowPolicy::DropNewest:
+						return PushResult::Dropped;
+					case OverflowPolicy::DropOldest:
+						result = PushResult::DroppedOldest;
+						break;
+					case OverflowPolicy::Collapse:
+						result = PushResult::Collapsed;
+						break;
+					}
+				}
+				m_posted.fetch_add(1, std::memory_order_relaxed);
+				return result;
+			}
+
+			// io thread, a reserved message arrived
+			void arrived() {
+				m_posted.fetch_sub(1, std::memory_order_relaxed);
+				wake_blocked();
+			}
+
+			// io thread, the out queue holds `count` messages now
+			void queued(size_t count) {
+				size_t previous = m_queued.load(std::memory_order_relaxed);
+				m_queued.store(count, std::memory_order_relaxed);
+				if (count < previous) {
+					wake_blocked();
+				}
+			}
+
+		private:
+			// parks the caller on m_room until pending() drops below the limit or the policy changes
+			void wait_for_room() {
+				m_blocked.fetch_add(1, std::memory_order_relaxed);
+				while (true) {
+					// pairs with the fence in wake_blocked(), either it sees this thread blocked or this thread sees the room it made
+					std::atomic_thread_fence(std::memory_order_seq_cst);
+					uint32_t room = m_room.load(std::memory_order_relaxed);
+					if (pending() < limit() || policy() != OverflowPolicy::Block) {
+						break;
+					}
+					futex_wait(m_room, room);
+				}
+				m_blocked.fetch_sub(1, std::memory_order_relaxed);
+			}
+
+			void wake_blocked() {
+				std::atomic_thread_fence(std::memory_order_seq_cst);
+				if (m_blocked.load(std::memory_order_relaxed) > 0) {
+					m_room.fetch_add(1, std::memory_order_relaxed);
+					futex_wake_all(m_room);
+				}
+			}
+
+			std::atomic<size_t> m_limit = CONNECTION_DEFAULT_OUT_QUEUE_LIMIT;
+			std::atomic<OverflowPolicy> m_policy = OverflowPolicy::DropNewest;
+			std::atomic<size_t> m_queued = 0;
+			std::atomic<size_t> m_posted = 0;
+			std::atomic<uint32_t> m_blocked = 0;
+			std::atomic<uint32_t> m_room = 0;
+		};
+
 		template <
 			IByteMessage T,
 			std::derived_from<IAsyncByteIO> AsyncT = IAsyncByteIO,
@@ -124,10 +301,31 @@ namespace xpo {
 			using AsyncT::AsyncT;
 
 		public:
-			void send_message(T const& msg) {
+			// what the out queue's overflow policy did with the message, see SendBackpressure::reserve()
+			PushResult send_message(T const& msg) {
+				PushResult result = m_backpressure.reserve();
+				if (result == PushResult::Dropped) {
+					m_metrics.sendDrops.add_shared();
+					return result;
+				}
 				this->execute_async([this, msg]() {
+					m_backpressure.arrived();
 					send_message_async(msg);
 				});
+				return result;
+			}
+
+			PushResult send_message(T&& msg) {
+				PushResult result = m_backpressure.reserve();
+				if (result == PushResult::Dropped) {
+					m_metrics.sendDrops.add_shared();
+					return result;
+				}
+				this->execute_async([this, msg = std::move(msg)]() mutable {
+					m_backpressure.arrived();
+					send_message_async(std::move(msg));
+				});
+				return result;
 			}
 
 			void listen_for_messages() {
@@ -136,14 +334,181 @@ namespace xpo {
 				});
 			}
 
+			// safe to read from any thread, e.g. every frame of the game loop
+			ConnectionMetricsSnapshot metrics_snapshot() const {
+				return m_metrics.snapshot();
+			}
+
+			ConnectionMetrics const& metrics() const {
+				return m_metrics;
+			}
+
+			// messages the out queue holds before overflow_policy() applies
+			size_t out_queue_limit() const {
+				return m_backpressure.limit();
+			}
+
+			void out_queue_limit(size_t limit) {
+				m_backpressure.limit(limit);
+			}
+
+			OverflowPolicy overflow_policy() const {
+				return m_backpressure.policy();
+			}
+
+			void overflow_policy(OverflowPolicy policy) {
+				m_backpressure.policy(policy);
+			}
+
+			// messages sent but not written yet, to pace sending by
+			size_t out_queue_pending() const {
+				return m_backpressure.pending();
+			}
+
 		protected:
 			void send_message_async(T const& msg) {
-				m_outQueue.push_back(msg);
-				if (m_outQueue.size() == 1) {
+				queue_out_message(msg);
+			}
+
+			void send_message_async(T&& msg) {
+				queue_out_message(std::move(msg));
+			}
+
+			template <class U>
+			void queue_out_message(U&& msg) {
+				if (m_outCount >= m_backpressure.limit()) {
+					switch (m_backpressure.policy()) {
+					case OverflowPolicy::Block:
+						break;
+					case OverflowPolicy::DropNewest:
+						m_metrics.sendDrops.add_shared();
+						return;
+					case OverflowPolicy::DropOldest:
+						if (m_outCount > 0) {
+							pop_out_message();
+						}
+						m_metrics.sendDrops.add_shared();
+						break;
+					case OverflowPolicy::Collapse:
+						// a queued message with the same key makes way for this one, failing that the oldest does
+						if constexpr (requires { m_outQueue.replace_last_if([](T const&) { return true; }, std::forward<U>(msg)); }) {
+							uint64_t key = collapse_key(msg);
+							if (m_outQueue.replace_last_if([this, key](T const& queued) { return collapse_key(queued) == key; }, std::forward<U>(msg))) {
+								m_metrics.sendCollapses.add();
+								return;
+							}
+						}
+						if (m_outCount > 0) {
+							pop_out_message();
+						}
+						m_metrics.sendDrops.add_shared();
+						break;
+					}
+				}
+
+				m_outQueue.push_back(std::forward<U>(msg));
+				queued_out_message();
+				if (!m_sending) {
+					m_sending = true;
+					start_send_async();
+				}
+			}
+
+			// messages with equal keys take each other's place in the out queue under OverflowPolicy::Collapse
+			virtual uint64_t collapse_key(T const& msg) {
+				return static_cast<uint64_t>(msg.header.m_id);
+			}
+
+			// called when a message is queued while idle, connections may hold off to gather more messages
+			virtual void start_send_async() {
+				begin_send_async();
+			}
+
+			// called once a send completed: starts on the next queued message, or goes idle if there's none
+			void continue_send_async() {
+				if (m_outQueue.empty()) {
+					m_sending = false;
+				}
+				else {
 					begin_send_async();
 				}
 			}
 
+			void queued_out_message() {
+				m_backpressure.queued(++m_outCount);
+				m_metrics.outQueueDepth.add();
+				if constexpr (NET_METRICS) {
+					// unsampled messages get an empty time
+					m_outQueueTimes.push_back(m_metrics.sample() ? ConnectionMetrics::clock::now() : ConnectionMetrics::clock::time_point());
+				}
+			}
+
+			// takes the next message to write off the out queue
+			T pop_out_message() {
+				m_backpressure.queued(--m_outCount);
+				m_metrics.outQueueDepth.sub();
+				if constexpr (NET_METRICS) {
+					auto queued = m_outQueueTimes.pop_front();
+					if (queued != ConnectionMetrics::clock::time_point()) {
+						m_metrics.queueResidency.record_since(queued);
+					}
+				}
+				return m_outQueue.pop_front();
+			}
+
+			// the processor's receive handlers, counted in m_metrics
+			void dispatch_receive(T& msg) {
+				m_metrics.packetsIn.add();
+				m_metrics.time_handler([this, &msg]() {
+					this->on_receive(msg);
+				});
+			}
+
+			bool dispatch_receive_header(typename T::header_type& header) {
+				if (this->on_receive_header(header)) {
+					return true;
+				}
+				m_metrics.headerDrops.add();
+				return false;
+			}
+
+			bool receive_failed(std::error_code ec) {
+				if (ec == make_error_code(ErrorCode::InvalidHeader)) {
+					m_metrics.invalidHeaders.add();
+				}
+				else {
+					m_metrics.receiveFailures.add();
+				}
+				return this->on_receive_fail(ec);
+			}
+
+			// what a StreamFramer hands its frames to, so they go through the counted paths above
+			struct MeteredReceiver {
+				ConnectionBase& connection;
+
+				void on_receive(T& msg) {
+					connection.dispatch_receive(msg);
+				}
+
+				bool on_receive_header(typename T::header_type& header) {
+					return connection.dispatch_receive_header(header);
+				}
+
+				bool on_receive_fail(std::error_code ec) {
+					return connection.receive_failed(ec);
+				}
+			};
+
+			void send_failed(std::error_code ec) {
+				m_metrics.sendFailures.add();
+				if (this->on_send_fail(ec)) {
+					continue_send_async();
+				}
+				else {
+					m_sending = false;
+				}
+			}
+
 			virtual void begin_receive_async() = 0;
 
 			virtual void begin_send_async() = 0;
@@ -152,209 +517,534 @@ namespace xpo {
 			T m_tempInMessage;
 			T m_tempOutMessage;
 			Q m_outQueue;
+			// when each message in m_outQueue was queued, for the residency histogram
+			Deque<ConnectionMetrics::clock::time_point> m_outQueueTimes;
+			// messages in m_outQueue, only the io thread touches it
+			size_t m_outCount = 0;
+			SendBackpressure m_backpressure;
+			// a message is being written, the next one goes out when it completes
+			bool m_sending = false;
+			ConnectionMetrics m_metrics;
 		};
 
+		// Splits a byte stream into messages, independent of how the bytes are read or where the messages go.
+		// The connection reads into free_space(), reports it with received() and calls parse(), which hands every
+		// complete frame to the handler and says what to read next. The handler needs on_receive_header(),
+		// on_receive() and on_receive_fail(), like an IMessageProcessor; it's a template, so a CRTP connection
+		// gets those calls bound at compile time.
 		template <IByteMessage T>
-		struct TCPConnection : public ConnectionBase<T, ASIOAsyncTCPSocket, TCPMessageProcessor<T>, ThreadSafeQueue<T>> {
-			using ConnectionBase<T, ASIOAsyncTCPSocket, TCPMessageProcessor<T>, ThreadSafeQueue<T>>::ConnectionBase;
+		struct StreamFramer {
+			using header_codec = HeaderCodec<typename T::header_type>;
 
-			void begin_receive_async() override {
-				header_receive_async();
+			enum class Next {
+				Read,		// read more into free_space()
+				ReadBody,	// read body_remaining() bytes into body_space(), then call body_received()
+				Stop,		// the handler gave up on the stream
+			};
+
+			size_t buffer_size() const {
+				return m_inBufferSize;
 			}
 
-			void header_receive_async() {
-				this->read_async((uint8_t*)(&this->m_tempInMessage.header), sizeof(this->m_tempInMessage.header), [=](std::error_code ec, size_t length) {
-					if (!ec && length == sizeof(this->m_tempInMessage.header)) {
-						if (this->on_receive_header(this->m_tempInMessage.header)) {
-							if (this->m_tempInMessage.header.size() > 0) {
-								body_receive_async();
-							}
-							else {
-								this->on_receive(this->m_tempInMessage);
-								header_receive_async();
-							}
-						}
-						else {
-							header_receive_async();
+			// only before allocate(), a read may be filling the buffer after that
+			void buffer_size(size_t size) {
+				assert(m_inBuffer == nullptr && "the read buffer can't be resized once the connection listens");
+				if (m_inBuffer == nullptr) {
+					m_inBufferSize = size;
+				}
+			}
+
+			void allocate() {
+				if (m_inBuffer == nullptr) {
+					m_inBuffer = std::make_unique<uint8_t[]>(m_inBufferSize);
+				}
+			}
+
+			uint8_t* free_space() {
+				return m_inBuffer.get() + m_inEnd;
+			}
+
+			size_t free_size() const {
+				return m_inBufferSize - m_inEnd;
+			}
+
+			void received(size_t count) {
+				m_inEnd += count;
+			}
+
+			// where the rest of a body too large for the buffer goes
+			uint8_t* body_space(T& msg) {
+				return msg.data() + m_bodyReceived;
+			}
+
+			size_t body_remaining(T const& msg) const {
+				return msg.header.size() - m_bodyReceived;
+			}
+
+			// handles every complete frame in the read buffer, then either asks for more
+			// or, for a frame that can't fit the buffer, for its body to be read straight into the message
+			template <class Handler>
+			Next parse(T& msg, Handler& handler) {
+				while (true) {
+					uint8_t* begin = m_inBuffer.get() + m_inBegin;
+					size_t available = m_inEnd - m_inBegin;
+
+					if (m_skipBytes > 0) {
+						size_t count = std::min(m_skipBytes, available);
+						m_inBegin += count;
+						m_skipBytes -= count;
+						if (m_skipBytes > 0) {
+							break;
 						}
+						continue;
 					}
-					else {
-						if (this->on_receive_fail(ec)) {
-							header_receive_async();
+
+					if (available < header_codec::min_size) {
+						break;
+					}
+					size_t headerSize = header_codec::encoded_size(begin, available);
+					if (headerSize > available && headerSize <= header_codec::max_size) {
+						break;
+					}
+					if (headerSize == 0 || header_codec::decode(msg.header, begin, available) != headerSize) {
+						// there's no telling where the next frame starts, drop everything we have
+						m_inBegin = m_inEnd = 0;
+						if (!handler.on_receive_fail(make_error_code(ErrorCode::InvalidHeader))) {
+							return Next::Stop;
 						}
+						break;
 					}
-					});
+
+					size_t bodySize = msg.header.size();
+					if (!handler.on_receive_header(msg.header)) {
+						m_inBegin += headerSize;
+						m_skipBytes = bodySize;
+						continue;
+					}
+
+					if (headerSize + bodySize <= available) {
+						msg.clear();
+						msg.add_data(begin + headerSize, bodySize);
+						m_inBegin += headerSize + bodySize;
+						handler.on_receive(msg);
+						continue;
+					}
+
+					if (headerSize + bodySize > m_inBufferSize) {
+						m_bodyReceived = available - headerSize;
+						msg.resize(bodySize);
+						std::memcpy(msg.data(), begin + headerSize, m_bodyReceived);
+						m_inBegin = m_inEnd = 0;
+						return Next::ReadBody;
+					}
+					break;
+				}
+
+				// move the incomplete frame to the front, so the rest of it lands right after it
+				if (m_inBegin == m_inEnd) {
+					m_inBegin = m_inEnd = 0;
+				}
+				else if (m_inBegin > 0) {
+					std::memmove(m_inBuffer.get(), m_inBuffer.get() + m_inBegin, m_inEnd - m_inBegin);
+					m_inEnd -= m_inBegin;
+					m_inBegin = 0;
+				}
+				return Next::Read;
 			}
 
-			void body_receive_async() {
-				// TODO: there's got to be a better way than using the 'new' operator
-				uint8_t* buffer = new uint8_t[this->m_tempInMessage.header.size()];
-				this->read_async(buffer, this->m_tempInMessage.header.size(), [this, buffer](std::error_code ec, size_t length) {
-					this->m_tempInMessage.data(buffer, length);
-					// Here we delete the allocated memory
-					delete[] buffer;
-					if (!ec && length == this->m_tempInMessage.header.size()) {
-						this->on_receive(this->m_tempInMessage);
-						header_receive_async();
+		private:
+			size_t m_inBufferSize = CONNECTION_TCP_DEFAULT_BUFFER_SIZE;
+			std::unique_ptr<uint8_t[]> m_inBuffer;
+			size_t m_inBegin = 0;
+			size_t m_inEnd = 0;
+			size_t m_skipBytes = 0;
+			size_t m_bodyReceived = 0;
+		};
+
+		// AsyncT may be any byte stream, e.g. UringTCPSocket
+		template <IByteMessage T, std::derived_from<IAsyncByteIO> AsyncT = ASIOAsyncTCPSocket>
+		struct TCPConnection : public ConnectionBase<T, AsyncT, TCPMessageProcessor<T>, ThreadSafeQueue<T>> {
+			using ConnectionBase<T, AsyncT, TCPMessageProcessor<T>, ThreadSafeQueue<T>>::ConnectionBase;
+
+			using header_codec = HeaderCodec<typename T::header_type>;
+
+			size_t in_buffer_size() const {
+				return m_framer.buffer_size();
+			}
+
+			// only before listen_for_messages()
+			void in_buffer_size(size_t size) {
+				m_framer.buffer_size(size);
+			}
+
+		protected:
+			void begin_receive_async() override {
+				m_framer.allocate();
+				stream_receive_async();
+			}
+
+			// reads whatever the socket has into the free end of the read buffer
+			void stream_receive_async() {
+				this->read_some_async(m_framer.free_space(), m_framer.free_size(), [this](std::error_code ec, size_t length) {
+					if (!ec) {
+						this->m_metrics.bytesIn.add(length);
+						m_framer.received(length);
+						parse_frames_from_byte_stream();
 					}
 					else {
-						if (this->on_receive_fail(ec)) {
-							header_receive_async();
+						if (this->receive_failed(ec)) {
+							stream_receive_async();
 						}
 					}
 					});
 			}
 
-			void begin_send_async() override {
-				header_send_async();
+			void parse_frames_from_byte_stream() {
+				typename TCPConnection::MeteredReceiver receiver{ *this };
+				switch (m_framer.parse(this->m_tempInMessage, receiver)) {
+				case StreamFramer<T>::Next::Read:
+					stream_receive_async();
+					break;
+				case StreamFramer<T>::Next::ReadBody:
+					body_receive_async();
+					break;
+				case StreamFramer<T>::Next::Stop:
+					break;
+				}
 			}
 
-			void header_send_async() {
-				this->m_tempOutMessage = this->m_outQueue.pop_front();
-				this->on_send(this->m_tempOutMessage);
-				this->write_async((uint8_t*)(&this->m_tempOutMessage.header), sizeof(this->m_tempOutMessage.header), [this](std::error_code ec, size_t length) {
-					if (!ec && length == sizeof(this->m_tempOutMessage.header)) {
-						if (this->m_tempOutMessage.header.size() > 0) {
-							body_send_async();
-						}
-						else {
-							if (!this->m_outQueue.empty()) {
-								header_send_async();
-							}
-						}
+			// reads the rest of a large body directly into the message's own storage
+			void body_receive_async() {
+				size_t remaining = m_framer.body_remaining(this->m_tempInMessage);
+				this->read_async(m_framer.body_space(this->m_tempInMessage), remaining, [this, remaining](std::error_code ec, size_t length) {
+					if (!ec && length == remaining) {
+						this->m_metrics.bytesIn.add(length);
+						this->dispatch_receive(this->m_tempInMessage);
+						stream_receive_async();
 					}
 					else {
-						if (this->on_send_fail(ec)) {
-							if (!this->m_outQueue.empty()) {
-									header_send_async();
-								}
+						if (this->receive_failed(ec)) {
+							stream_receive_async();
 						}
 					}
 					});
 			}
 
-			void body_send_async() {
-				this->write_async(this->m_tempOutMessage.data(), this->m_tempOutMessage.header.size(), [this](std::error_code ec, size_t length) {
-					if (!ec && length == this->m_tempOutMessage.header.size()) {
-						if (!this->m_outQueue.empty()) {
-							header_send_async();
-						}
+			void begin_send_async() override {
+				message_send_async();
+			}
+
+			// header and body go out in a single gather write
+			void message_send_async() {
+				this->m_tempOutMessage = this->pop_out_message();
+				this->on_send(this->m_tempOutMessage);
+				size_t headerSize = header_codec::encode(this->m_tempOutMessage.header, m_headerOutBuffer);
+				if (headerSize == 0) {
+					this->send_failed(make_error_code(ErrorCode::MessageTooLarge));
+					return;
+				}
+				size_t bodySize = this->m_tempOutMessage.header.size();
+				ConstByteBuffer buffers[2] = {
+					{ m_headerOutBuffer, headerSize },
+					{ this->m_tempOutMessage.data(), bodySize }
+				};
+				this->write_async(std::span<ConstByteBuffer const>(buffers, bodySize > 0 ? 2 : 1), [this, total = headerSize + bodySize](std::error_code ec, size_t length) {
+					if (!ec && length == total) {
+						this->m_metrics.bytesOut.add(length);
+						this->m_metrics.packetsOut.add();
+						this->continue_send_async();
 					}
 					else {
-						if (this->on_send_fail(ec) && !this->m_outQueue.empty()) {
-							header_send_async();
-						}
+						this->send_failed(ec);
 					}
 					});
 			}
+
+		protected:
+			StreamFramer<T> m_framer;
+
+			uint8_t m_headerOutBuffer[header_codec::max_size];
 		};
 
-		template <IByteMessage T>
-		struct UDPConnection : public ConnectionBase<OwnedMessage<T>, ASIOAsyncUDPSocket, UDPMessageProcessor<T>, ThreadSafeQueue<OwnedMessage<T>>> {
-			using ConnectionBase<OwnedMessage<T>, ASIOAsyncUDPSocket, UDPMessageProcessor<T>, ThreadSafeQueue<OwnedMessage<T>>>::ConnectionBase;
+		// AsyncT may be a batched socket (see BatchedUDPSocket.h and UringSocket.h), then several datagrams move per operation.
+		// sockets that aren't batched must be asio ones, they send to m_remoteOutEndPoint.
+		template <IByteMessage T, std::derived_from<IAsyncByteIO> AsyncT = ASIOAsyncUDPSocket>
+		requires IBatchedDatagramIO<AsyncT> || std::derived_from<AsyncT, ASIOAsyncUDPSocket>
+		struct UDPConnection : public ConnectionBase<OwnedMessage<T>, AsyncT, UDPMessageProcessor<T>, ThreadSafeQueue<OwnedMessage<T>>> {
+			using ConnectionBase<OwnedMessage<T>, AsyncT, UDPMessageProcessor<T>, ThreadSafeQueue<OwnedMessage<T>>>::ConnectionBase;
+
+			using header_codec = HeaderCodec<typename T::header_type>;
 
-			void send_message_to(T const& msg, asio::ip::udp::endpoint& endPoint) {
-				send_message(OwnedMessage(msg, endPoint));
+			void send_message_to(T const& msg, asio::ip::udp::endpoint const& endPoint) {
+				this->send_message(OwnedMessage<T>(msg, endPoint));
+			}
+
+			void send_message_to(T&& msg, asio::ip::udp::endpoint const& endPoint) {
+				this->send_message(OwnedMessage<T>(std::move(msg), endPoint));
+			}
+
+			void send_message_to(SharedMessage<T> const& msg, asio::ip::udp::endpoint const& endPoint) {
+				this->send_message(OwnedMessage<T>(msg, endPoint));
+			}
+
+			// queues the same encoded message for every endpoint with a single hop onto the io thread
+			template <class Endpoints>
+			void broadcast(SharedMessage<T> const& msg, Endpoints const& endPoints) {
+				this->execute_async([this, msg, endPoints = std::vector<asio::ip::udp::endpoint>(std::begin(endPoints), std::end(endPoints))]() {
+					for (auto const& endPoint : endPoints) {
+						this->send_message_async(OwnedMessage<T>(msg, endPoint));
+					}
+				});
 			}
 
 			size_t in_buffer_size() const {
 				return m_inBufferSize;
 			}
 
+			// only before listen_for_messages(), or after free_in_buffer()
 			void in_buffer_size(size_t size) {
-				m_inBufferSize = size;
+				assert(m_inBuffer == nullptr && "the read buffer can't be resized once the connection listens");
+				if (m_inBuffer == nullptr) {
+					m_inBufferSize = size;
+				}
 			}
 
+			// the largest datagram sent, i.e. the mtu coalesced messages are packed up to
 			size_t out_buffer_size() const {
-				return m_inBufferSize;
+				return m_outBufferSize;
 			}
 
 			void out_buffer_size(size_t size) {
 				m_outBufferSize = size;
 			}
 
-			void free_in_buffer() {
-				delete[] m_inBuffer;
+			// whether consecutive messages to the same endpoint are packed into one datagram
+			bool coalesce() const {
+				return m_coalesce;
+			}
+
+			void coalesce(bool enabled) {
+				m_coalesce = enabled;
+			}
+
+			std::chrono::microseconds flush_deadline() const {
+				return m_flushDeadline;
 			}
 
-			void free_out_buffer() {
+			void flush_deadline(std::chrono::microseconds deadline) {
+				m_flushDeadline = deadline;
+			}
+
+			// sends whatever is waiting for the flush deadline now
+			void flush() {
+				this->execute_async([this]() {
+					if (m_flushTimer) {
+						m_flushTimer->cancel();
+					}
+				});
+			}
+
+			void free_in_buffer() {
 				delete[] m_inBuffer;
+				m_inBuffer = nullptr;
 			}
 
 		protected:
-			void begin_send_async() override {
-				if (m_outBuffer == nullptr) {
-					m_outBuffer = new uint8_t[m_outBufferSize];
+			void start_send_async() override {
+				if constexpr (has_flush_timer) {
+					if (m_coalesce && m_flushDeadline.count() > 0) {
+						if (!m_flushTimer) {
+							m_flushTimer.emplace(this->socket().get_executor());
+						}
+						// runs early if the timer gets cancelled by flush()
+						m_flushTimer->expires_after(m_flushDeadline);
+						m_flushTimer->async_wait([this](std::error_code) {
+							message_send_async();
+						});
+						return;
+					}
 				}
 				message_send_async();
 			}
 
+			void begin_send_async() override {
+				message_send_async();
+			}
+
 			void begin_receive_async() override {
 				if (m_inBuffer == nullptr) {
-					m_inBuffer = new uint8_t[m_inBufferSize];
+					m_inBuffer = new uint8_t[m_inBufferSize * max_datagrams];
 				}
 				message_receive_async();
 			}
 
+			// packs queued messages into datagrams, consecutive messages for the same endpoint sharing one up to the mtu.
+			// a batched socket sends up to max_datagrams of them at once, otherwise it's one datagram per write.
 			void message_send_async() {
-				this->m_tempOutMessage = this->m_outQueue.pop_front();
-				this->m_remoteOutEndPoint = this->m_tempOutMessage.endpoint();
-				this->on_send(this->m_tempOutMessage);
-				std::memcpy(m_outBuffer, &this->m_tempOutMessage.header, sizeof(this->m_tempOutMessage.header));
-				std::memcpy(m_outBuffer + sizeof(this->m_tempOutMessage.header), this->m_tempOutMessage.data(), this->m_tempOutMessage.header.size());
-				this->write_async(m_outBuffer, sizeof(this->m_tempOutMessage.header) + this->m_tempOutMessage.header.size(), [this](std::error_code ec, size_t length) {
+				if (m_sendBatch.capacity() == 0) {
+					// the batch never reallocates, so the body buffers pointing into it stay valid
+					m_sendBatch.reserve(max_batch_size);
+				}
+				m_sendBatch.clear();
+				m_sendBatchBytes = 0;
+				size_t bufferCount = 0;
+				size_t datagramCount = 0;
+				size_t datagramBegin = 0;
+				size_t datagramSize = 0;
+				while (!this->m_outQueue.empty() && m_sendBatch.size() < max_batch_size) {
+					auto& next = this->m_outQueue.front();
+					ConstByteBuffer header = encode_header(next, m_headerOutBuffers[m_sendBatch.size()]);
+					size_t messageSize = header.size + next.header.size();
+					if (header.size == 0 || messageSize > m_outBufferSize) {
+						if (!m_sendBatch.empty()) {
+							// send what we have, this one fails on its own next time around
+							break;
+						}
+						auto msg = this->pop_out_message();
+						this->on_send(msg);
+						this->send_failed(make_error_code(ErrorCode::MessageTooLarge));
+						return;
+					}
+
+					bool joinsDatagram = datagramCount > 0
+						&& m_coalesce
+						&& next.endpoint() == m_datagrams[datagramCount - 1].endpoint
+						&& datagramSize + messageSize <= m_outBufferSize;
+					if (!joinsDatagram) {
+						if (datagramCount == max_datagrams) {
+							break;
+						}
+						if (datagramCount > 0) {
+							m_datagrams[datagramCount - 1].buffers = { m_sendBuffers.data() + datagramBegin, bufferCount - datagramBegin };
+						}
+						m_datagrams[datagramCount++].endpoint = next.endpoint();
+						datagramBegin = bufferCount;
+						datagramSize = 0;
+					}
+
+					auto& msg = m_sendBatch.emplace_back(this->pop_out_message());
+					this->on_send(msg);
+					// the body is sent straight from the message, no copy into an out buffer
+					m_sendBuffers[bufferCount++] = header;
+					if (msg.header.size() > 0) {
+						m_sendBuffers[bufferCount++] = msg.is_shared()
+							? ConstByteBuffer{ msg.shared().body().data(), msg.shared().body().size() }
+							: ConstByteBuffer{ msg.data(), msg.header.size() };
+					}
+					datagramSize += messageSize;
+					m_sendBatchBytes += messageSize;
+				}
+
+				if (datagramCount == 0) {
+					this->continue_send_async();
+					return;
+				}
+				m_datagrams[datagramCount - 1].buffers = { m_sendBuffers.data() + datagramBegin, bufferCount - datagramBegin };
+
+				auto onSent = [this](std::error_code ec, size_t length) {
 					if (!ec) {
-						if (this->m_outQueue.size() > 0) {
-							message_send_async();
+						this->m_metrics.bytesOut.add(m_sendBatchBytes);
+						this->m_metrics.packetsOut.add(m_sendBatch.size());
+						for (auto& msg : m_sendBatch) {
+							message_sent(msg);
 						}
+						this->continue_send_async();
 					}
 					else {
-						if (this->on_send_fail(ec)) {
-							if (this->m_outQueue.size() > 0) {
-								message_send_async();
-							}
-						}
+						this->send_failed(ec);
 					}
-				});
+				};
+				if constexpr (batched_io) {
+					this->write_batch_async(std::span<DatagramOut const>(m_datagrams.data(), datagramCount), onSent);
+				}
+				else {
+					this->m_remoteOutEndPoint = m_datagrams[0].endpoint;
+					this->write_async(m_datagrams[0].buffers, onSent);
+				}
+			}
+
+			// the same message id for the same endpoint
+			uint64_t collapse_key(OwnedMessage<T> const& msg) override {
+				return UDPEndpointHash()(msg.endpoint()) ^ (static_cast<uint64_t>(msg.header.m_id) * 0x9E3779B97F4A7C15ull);
+			}
+
+			// a message was written, called after its batch completed
+			virtual void message_sent(OwnedMessage<T> const& msg) {}
+
+			// shared messages come encoded already, every recipient gets the same bytes
+			ConstByteBuffer encode_header(OwnedMessage<T> const& msg, uint8_t* out) {
+				if (msg.is_shared()) {
+					return { msg.shared().header_bytes().data(), msg.shared().header_bytes().size() };
+				}
+				return { out, header_codec::encode(msg.header, out) };
 			}
 
 			void message_receive_async() {
+				if constexpr (batched_io) {
+					for (size_t i = 0; i < max_datagrams; ++i) {
+						m_datagramsIn[i] = { m_inBuffer + i * m_inBufferSize, m_inBufferSize, 0, {} };
+					}
+					this->read_batch_async(std::span<DatagramIn>(m_datagramsIn), [this](std::error_code ec, size_t count) {
+						if (!ec) {
+							for (size_t i = 0; i < count; ++i) {
+								// so remote_endpoint() is the sender of the message being handled
+								this->m_remoteInEndPoint = m_datagramsIn[i].endpoint;
+								this->m_metrics.bytesIn.add(m_datagramsIn[i].size);
+								if (!parse_message_from_byte_stream(m_datagramsIn[i].data, m_datagramsIn[i].size)) {
+									return;
+								}
+							}
+							message_receive_async();
+						}
+						else {
+							if (this->receive_failed(ec)) {
+								message_receive_async();
+							}
+						}
+					});
+					return;
+				}
+
 				this->read_async(m_inBuffer, m_inBufferSize, [this](std::error_code ec, size_t length) {
 					if (!ec) {
-						if (parse_message_from_byte_stream(length)) {
+						this->m_metrics.bytesIn.add(length);
+						if (parse_message_from_byte_stream(m_inBuffer, length)) {
 							message_receive_async();
 						}
 					}
 					else {
-						if (this->on_receive_fail(ec)) {
+						if (this->receive_failed(ec)) {
 							message_receive_async();
 						}
 					}
 				});
 			}
 
-			bool parse_message_from_byte_stream(size_t bytesReceived) {
+			bool parse_message_from_byte_stream(uint8_t* datagram, size_t bytesReceived) {
 				// otherwise, try to parse a new message
 				// we should pasre the whole buffer, since it is being overwriten every time we receive
 
-				uint8_t* begin = m_inBuffer;
+				uint8_t* begin = datagram;
 				uint8_t* end = begin + bytesReceived;
-				constexpr size_t const sizeOfHeader = sizeof(this->m_tempInMessage.header);
-				bytesReceived -= sizeOfHeader;
 				// we are not parsing a message write now, lets parse a new one
 				while (begin != end) {
 					if (m_remainingBytesForCurrentMessage == 0) {
-						if (end - begin < sizeOfHeader) {
-							return this->on_receive_fail(make_error_code(ErrorCode::InvalidHeader));
-						}
 						this->m_tempInMessage.clear();
-						std::memcpy(&this->m_tempInMessage.header, begin, sizeOfHeader);
+						size_t sizeOfHeader = header_codec::decode(this->m_tempInMessage.header, begin, end - begin);
+						if (sizeOfHeader == 0) {
+							return this->receive_failed(make_error_code(ErrorCode::InvalidHeader));
+						}
+						begin += sizeOfHeader;
 						m_remainingBytesForCurrentMessage = this->m_tempInMessage.header.size();
-						if ((m_remainingBytesForCurrentMessage < m_inBufferSize && m_remainingBytesForCurrentMessage > bytesReceived) || !this->on_receive_header(this->m_tempInMessage.header)) {
+						size_t bytesLeft = end - begin;
+						if (m_remainingBytesForCurrentMessage < m_inBufferSize && m_remainingBytesForCurrentMessage > bytesLeft) {
+							m_remainingBytesForCurrentMessage = 0;
+							return this->receive_failed(make_error_code(ErrorCode::InvalidHeader));
+						}
+						if (!this->dispatch_receive_header(this->m_tempInMessage.header)) {
 							m_remainingBytesForCurrentMessage = 0;
 							return this->on_receive_fail(make_error_code(ErrorCode::InvalidHeader));
 						}
-						begin += sizeOfHeader;
 					}
 					uint8_t* endOfMessageBuffer = std::min(end, begin + m_remainingBytesForCurrentMessage);
 					size_t count = endOfMessageBuffer - begin;
@@ -362,7 +1052,7 @@ namespace xpo {
 					m_remainingBytesForCurrentMessage -= count;
 
 					if (m_remainingBytesForCurrentMessage == 0) {
-						this->on_receive(this->m_tempInMessage);
+						this->dispatch_receive(this->m_tempInMessage);
 					}
 
 					begin += count;
@@ -377,8 +1067,25 @@ namespace xpo {
 			size_t m_remainingBytesForCurrentMessage = 0;
 			size_t m_inBufferOffset;
 
+			static constexpr bool const batched_io = IBatchedDatagramIO<AsyncT>;
+			static constexpr size_t const max_datagrams = batched_io ? BATCHED_UDP_MAX_DATAGRAMS : 1;
+			// every message takes up to two gather buffers, its header and its body
+			static constexpr size_t const max_batch_size = ASYNC_IO_MAX_BUFFERS / 2;
+
+			// largest datagram we are willing to send
 			size_t m_outBufferSize = CONNECTION_UDP_DEFAULT_BUFFER_SIZE;
-			uint8_t* m_outBuffer = nullptr;
+			bool m_coalesce = true;
+			std::chrono::microseconds m_flushDeadline{ CONNECTION_UDP_DEFAULT_FLUSH_DEADLINE_US };
+			// the flush deadline needs an asio executor, other sockets always send right away
+			static constexpr bool const has_flush_timer = requires (AsyncT& io) { io.socket().get_executor(); };
+			std::optional<asio::steady_timer> m_flushTimer;
+
+			std::vector<OwnedMessage<T>> m_sendBatch;
+			size_t m_sendBatchBytes = 0;
+			std::array<ConstByteBuffer, ASYNC_IO_MAX_BUFFERS> m_sendBuffers;
+			std::array<DatagramOut, max_datagrams> m_datagrams;
+			std::array<DatagramIn, max_datagrams> m_datagramsIn;
+			uint8_t m_headerOutBuffers[max_batch_size][header_codec::max_size];
 		};
 	}
 }
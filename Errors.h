@@ -7,6 +7,10 @@ namespace xpo {
 	namespace net {
 		enum class ErrorCode {
 			InvalidHeader = 1,
+			MessageTooLarge = 2,
+			ChannelFull = 3,
+			SessionLimit = 4,
+			PeerTimedOut = 5,
 		};
 
 		struct NetError : public std::error_category {
@@ -19,9 +23,18 @@ namespace xpo {
 				{
 				case ErrorCode::InvalidHeader:
 					return "Invalid Header";
+				case ErrorCode::MessageTooLarge:
+					return "Message Too Large";
+				case ErrorCode::ChannelFull:
+					return "Channel Full";
+				case ErrorCode::SessionLimit:
+					return "Session Limit Reached";
+				case ErrorCode::PeerTimedOut:
+					return "Peer Timed Out";
 				default:
 					break;
 				}
+				return "Unknown Error";
 			}
 
 			virtual bool equivalent(const std::error_code& code, int condition) const noexcept {
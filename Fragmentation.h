@@ -0,0 +1,368 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstring>
+#include <memory>
+#include <stdint.h>
+
+#include "./Connection.h"
+#include "./Errors.h"
+#include "./IMessage.h"
+#include "./MessageStream.h"
+#include "./Session.h"
+
+// largest message that can be sent in fragments, every reassembly slot holds one of these
+#ifndef FRAGMENT_MAX_MESSAGE_SIZE
+#define FRAGMENT_MAX_MESSAGE_SIZE (64 * 1024)
+#endif
+
+// messages reassembled at the same time per endpoint, so at most
+// FRAGMENT_REASSEMBLY_SLOTS * FRAGMENT_MAX_MESSAGE_SIZE bytes are held for one endpoint
+#ifndef FRAGMENT_REASSEMBLY_SLOTS
+#define FRAGMENT_REASSEMBLY_SLOTS 4
+#endif
+
+// how long an incomplete message waits for its missing fragments before it is dropped
+#ifndef FRAGMENT_TIMEOUT_MS
+#define FRAGMENT_TIMEOUT_MS 1000
+#endif
+
+// completed messages per endpoint whose late or duplicate fragments are recognised and dropped,
+// each for FRAGMENT_TIMEOUT_MS after it completed
+#ifndef FRAGMENT_COMPLETED_HISTORY
+#define FRAGMENT_COMPLETED_HISTORY 16
+#endif
+
+
+namespace xpo {
+	namespace net {
+		// Wire prefix in front of every fragment's slice of the body:
+		//   uint16 message id, uint8 fragment index, uint8 last fragment index, uint16 stride, commands original id
+		// Every fragment but the last carries exactly `stride` bytes, so fragment i lands at i * stride.
+		template <class H>
+		struct FragmentPrefix {
+			static constexpr size_t const size = sizeof(uint16_t) + sizeof(uint8_t) * 2 + sizeof(uint16_t) + sizeof(typename H::commands);
+			static constexpr size_t const max_fragments = 256;
+
+			uint16_t message;
+			uint8_t index;
+			uint8_t last;
+			uint16_t stride;
+			typename H::commands id;
+		};
+
+		// Puts together the fragmented messages of one endpoint.
+		// There's a fixed number of slots, each with a buffer allocated the first time it's used and kept from then on,
+		// and a bitmap of the fragments it has. Slots whose message doesn't complete in time are reused.
+		// The ids of the last few completed messages are kept, so a fragment arriving after its message was
+		// delivered is dropped instead of starting a new slot and maybe pushing out a live one.
+		template <IByteMessage M>
+		class Reassembler {
+		public:
+			using clock = std::chrono::steady_clock;
+			using header_type = typename M::header_type;
+			using prefix_type = FragmentPrefix<header_type>;
+
+			// adds the fragment `packet` and calls deliver(M&) if it completed its message.
+			// returns false if the fragment is malformed.
+			template <class Deliver>
+			bool receive(M const& packet, clock::time_point now, Deliver&& deliver) {
+				MessageReader reader(packet.body());
+				prefix_type prefix;
+				reader >> prefix.message >> prefix.index >> prefix.last >> prefix.stride >> prefix.id;
+				if (!reader) {
+					return false;
+				}
+				auto bytes = reader.remaining_bytes();
+				bool isLast = prefix.index == prefix.last;
+				if (prefix.index > prefix.last || prefix.stride == 0
+					|| (isLast ? bytes.size() > prefix.stride : bytes.size() != prefix.stride)
+					|| size_t(prefix.last) * prefix.stride + (isLast ? bytes.size() : 0) > FRAGMENT_MAX_MESSAGE_SIZE) {
+					return false;
+				}
+
+				Slot* slot = find(prefix.message);
+				if (slot == nullptr) {
+					if (completed(prefix.message, now)) {
+						// a duplicate or late fragment, its message was delivered already
+						return true;
+					}
+					slot = &acquire(now);
+					slot->start(prefix, now);
+				}
+				else if (slot->last != prefix.last || slot->stride != prefix.stride || slot->id != prefix.id) {
+					return false;
+				}
+
+				if (!slot->has(prefix.index)) {
+					slot->set(prefix.index);
+					if (!bytes.empty()) {
+						std::memcpy(slot->buffer.get() + size_t(prefix.index) * prefix.stride, bytes.data(), bytes.size());
+					}
+					if (isLast) {
+						slot->size = size_t(prefix.last) * prefix.stride + bytes.size();
+					}
+				}
+
+				if (slot->received == size_t(slot->last) + 1) {
+					M msg;
+					msg.header.m_id = slot->id;
+					msg.resize(slot->size);
+					if (slot->size > 0) {
+						std::memcpy(msg.data(), slot->buffer.get(), slot->size);
+					}
+					msg.header.m_size = slot->size;
+					slot->active = false;
+					m_completed[m_completedNext] = { slot->message, now };
+					m_completedNext = (m_completedNext + 1) % m_completed.size();
+					deliver(msg);
+				}
+				return true;
+			}
+
+			// drops incomplete messages that waited longer than FRAGMENT_TIMEOUT_MS, returns how many
+			size_t evict(clock::time_point now) {
+				size_t count = 0;
+				for (auto& slot : m_slots) {
+					if (slot.active && expired(slot, now)) {
+						slot.active = false;
+						++count;
+					}
+				}
+				return count;
+			}
+
+			// messages being put together right now
+			size_t pending() const {
+				size_t count = 0;
+				for (auto const& slot : m_slots) {
+					count += slot.active ? 1 : 0;
+				}
+				return count;
+			}
+
+		private:
+			struct Slot {
+				void start(prefix_type const& prefix, clock::time_point now) {
+					if (!buffer) {
+						buffer = std::make_unique<uint8_t[]>(FRAGMENT_MAX_MESSAGE_SIZE);
+					}
+					active = true;
+					message = prefix.message;
+					last = prefix.last;
+					stride = prefix.stride;
+					id = prefix.id;
+					size = 0;
+					received = 0;
+					started = now;
+					bits.fill(0);
+				}
+
+				bool has(uint8_t index) const {
+					return bits[index / 64] & (uint64_t(1) << (index % 64));
+				}
+
+				void set(uint8_t index) {
+					bits[index / 64] |= uint64_t(1) << (index % 64);
+					++received;
+				}
+
+				bool active = false;
+				uint16_t message = 0;
+				uint8_t last = 0;
+				uint16_t stride = 0;
+				typename header_type::commands id{};
+				size_t size = 0;
+				size_t received = 0;
+				clock::time_point started;
+				std::array<uint64_t, prefix_type::max_fragments / 64> bits{};
+				std::unique_ptr<uint8_t[]> buffer;
+			};
+
+			static bool expired(Slot const& slot, clock::time_point now) {
+				return now - slot.started >= std::chrono::milliseconds(FRAGMENT_TIMEOUT_MS);
+			}
+
+			Slot* find(uint16_t message) {
+				for (auto& slot : m_slots) {
+					if (slot.active && slot.message == message) {
+						return &slot;
+					}
+				}
+				return nullptr;
+			}
+
+			// whether `message` completed within the last FRAGMENT_TIMEOUT_MS
+			bool completed(uint16_t message, clock::time_point now) const {
+				for (auto const& done : m_completed) {
+					if (done.message == message && now - done.at < std::chrono::milliseconds(FRAGMENT_TIMEOUT_MS)) {
+						return true;
+					}
+				}
+				return false;
+			}
+
+			// a free slot, else an expired one, else the oldest; whatever it held is dropped
+			Slot& acquire(clock::time_point now) {
+				Slot* oldest = &m_slots[0];
+				for (auto& slot : m_slots) {
+					if (!slot.active || expired(slot, now)) {
+						return slot;
+					}
+					if (slot.started < oldest->started) {
+						oldest = &slot;
+					}
+				}
+				return *oldest;
+			}
+
+			struct Completed {
+				uint16_t message = 0;
+				clock::time_point at;
+			};
+
+			std::array<Slot, FRAGMENT_REASSEMBLY_SLOTS> m_slots;
+			// ring of recently completed message ids, m_completedNext is overwritten next
+			std::array<Completed, FRAGMENT_COMPLETED_HISTORY> m_completed{};
+			size_t m_completedNext = 0;
+		};
+
+		// UDPConnection that splits messages too large for one datagram into fragments and puts them back together.
+		// Fragments are sent as messages with the reserved command id given on construction, everything else goes out
+		// as usual, so messages that fit pay nothing. Override on_complete_receive() instead of on_receive(),
+		// and call update() now and then to drop messages whose fragments stopped coming.
+		//
+		// Both ends should use the same datagram size, in_buffer_size() on the receiver must fit the sender's out_buffer_size().
+		// Fragments aren't retransmitted, a lost one loses the whole message.
+		template <IByteMessage T, std::derived_from<IAsyncByteIO> AsyncT = ASIOAsyncUDPSocket>
+		struct FragmentingUDPConnection : public UDPConnection<T, AsyncT> {
+			using clock = std::chrono::steady_clock;
+			using header_type = typename T::header_type;
+			using commands = typename header_type::commands;
+			using prefix_type = FragmentPrefix<header_type>;
+			using header_codec = HeaderCodec<header_type>;
+
+			template <class... Args>
+			FragmentingUDPConnection(commands fragmentId, Args&&... args)
+				: UDPConnection<T, AsyncT>(std::forward<Args>(args)...)
+				, m_fragmentId(fragmentId)
+			{}
+
+			void send_message_to(T const& msg, asio::ip::udp::endpoint const& endPoint) {
+				this->execute_async([this, msg, endPoint]() {
+					send_fragmented_async(msg, endPoint);
+				});
+			}
+
+			void send_message_to(T&& msg, asio::ip::udp::endpoint const& endPoint) {
+				this->execute_async([this, msg = std::move(msg), endPoint]() mutable {
+					send_fragmented_async(std::move(msg), endPoint);
+				});
+			}
+
+			// how long an endpoint that stopped sending fragments keeps its reassembly buffers
+			std::chrono::milliseconds idle_timeout() const {
+				return m_idleTimeout;
+			}
+
+			void idle_timeout(std::chrono::milliseconds timeout) {
+				m_idleTimeout = timeout;
+			}
+
+			void update() {
+				this->execute_async([this]() {
+					auto now = clock::now();
+					// endpoints that stopped sending fragments give their buffers back
+					m_reassemblers.evict_idle(now, m_idleTimeout, [](asio::ip::udp::endpoint const&, Reassembler<T>&) {});
+					m_reassemblers.for_each([now](asio::ip::udp::endpoint const&, Reassembler<T>& reassembler) {
+						reassembler.evict(now);
+					});
+				});
+			}
+
+			// frees everything held for an endpoint
+			void disconnect(asio::ip::udp::endpoint const& endPoint) {
+				this->execute_async([this, endPoint]() {
+					m_reassemblers.remove(endPoint);
+				});
+			}
+
+			// every message in full, whether it fit in a datagram or was reassembled
+			virtual void on_complete_receive(T& msg) {
+				NET_LOG_DEBUG("Received: ", msg);
+			}
+
+		protected:
+			void on_receive(T& packet) override {
+				if (packet.header.m_id != m_fragmentId) {
+					on_complete_receive(packet);
+					return;
+				}
+				auto now = clock::now();
+				Reassembler<T>* reassembler = m_reassemblers.find_or_insert(this->remote_endpoint(), now).first;
+				if (reassembler == nullptr) {
+					this->receive_failed(make_error_code(ErrorCode::SessionLimit));
+					return;
+				}
+				bool ok = reassembler->receive(packet, now, [this](T& msg) {
+					on_complete_receive(msg);
+				});
+				if (!ok) {
+					this->receive_failed(make_error_code(ErrorCode::InvalidHeader));
+				}
+			}
+
+			// fragments are never retransmitted, so no two may collapse: each one is keyed on its message and index too
+			uint64_t collapse_key(OwnedMessage<T> const& msg) override {
+				uint64_t key = UDPConnection<T, AsyncT>::collapse_key(msg);
+				if (msg.header.m_id != m_fragmentId || msg.is_shared()) {
+					return key;
+				}
+				MessageReader reader(msg.body());
+				uint16_t message = 0;
+				uint8_t index = 0;
+				reader >> message >> index;
+				return key ^ ((uint64_t(message) << 8 | index) * 0xC2B2AE3D27D4EB4Full);
+			}
+
+			template <class Msg>
+			void send_fragmented_async(Msg&& msg, asio::ip::udp::endpoint const& endPoint) {
+				size_t size = msg.header.size();
+				if (header_codec::max_size + size <= this->m_outBufferSize) {
+					this->send_message_async(OwnedMessage<T>(std::forward<Msg>(msg), endPoint));
+					return;
+				}
+
+				// every fragment is its own message, so leave room for its header and the prefix
+				size_t room = this->m_outBufferSize - std::min(this->m_outBufferSize, header_codec::max_size + prefix_type::size);
+				size_t stride = std::min<size_t>(room, UINT16_MAX);
+				size_t count = stride == 0 ? 0 : (size + stride - 1) / stride;
+				if (count == 0 || count > prefix_type::max_fragments || size > FRAGMENT_MAX_MESSAGE_SIZE) {
+					this->on_send_fail(make_error_code(ErrorCode::MessageTooLarge));
+					return;
+				}
+
+				uint16_t message = m_nextMessage++;
+				auto body = msg.body();
+				for (size_t i = 0; i < count; ++i) {
+					size_t offset = i * stride;
+					size_t length = std::min(stride, size - offset);
+					T fragment;
+					fragment.header.m_id = m_fragmentId;
+					fragment.resize(prefix_type::size + length);
+					BufferWriter writer(fragment.data());
+					writer << message << static_cast<uint8_t>(i) << static_cast<uint8_t>(count - 1) << static_cast<uint16_t>(stride) << msg.header.m_id;
+					writer.write_bytes(body.data() + offset, length);
+					fragment.header.m_size = prefix_type::size + length;
+					this->send_message_async(OwnedMessage<T>(std::move(fragment), endPoint));
+				}
+			}
+
+			commands m_fragmentId;
+			uint16_t m_nextMessage = 0;
+			SessionTable<Reassembler<T>> m_reassemblers;
+			std::chrono::milliseconds m_idleTimeout{ SESSION_DEFAULT_IDLE_TIMEOUT_MS };
+		};
+	}
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <stdint.h>
+
+#if defined(_WIN32)
+#include <winsock2.h>
+#include <windows.h>
+#pragma comment(lib, "Synchronization.lib")
+#elif defined(__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+
+namespace xpo {
+	namespace net {
+		// blocks the calling thread while `word` still holds `expected`. may wake up spuriously,
+		// so callers must re-check their condition.
+		inline void futex_wait(std::atomic<uint32_t>& word, uint32_t expected) {
+#if defined(_WIN32)
+			WaitOnAddress(reinterpret_cast<volatile VOID*>(&word), &expected, sizeof(expected), INFINITE);
+#elif defined(__linux__)
+			syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAIT_PRIVATE, expected, nullptr, nullptr, 0);
+#else
+			word.wait(expected);
+#endif
+		}
+
+		// same as futex_wait(), but gives up after `timeout`.
+		inline void futex_wait_for(std::atomic<uint32_t>& word, uint32_t expected, std::chrono::nanoseconds timeout) {
+#if defined(_WIN32)
+			DWORD ms = static_cast<DWORD>(std::chrono::ceil<std::chrono::milliseconds>(timeout).count());
+			WaitOnAddress(reinterpret_cast<volatile VOID*>(&word), &expected, sizeof(expected), ms);
+#elif defined(__linux__)
+			timespec ts;
+			ts.tv_sec = static_cast<time_t>(timeout.count() / 1000000000);
+			ts.tv_nsec = static_cast<long>(timeout.count() % 1000000000);
+			syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAIT_PRIVATE, expected, &ts, nullptr, 0);
+#else
+			// std::atomic has no timed wait, poll instead
+			if (word.load() == expected) {
+				std::this_thread::sleep_for(std::min<std::chrono::nanoseconds>(timeout, std::chrono::milliseconds(1)));
+			}
+#endif
+		}
+
+		inline void futex_wake_one(std::atomic<uint32_t>& word) {
+#if defined(_WIN32)
+			WakeByAddressSingle(reinterpret_cast<PVOID>(&word));
+#elif defined(__linux__)
+			syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+#else
+			word.notify_one();
+#endif
+		}
+
+		inline void futex_wake_all(std::atomic<uint32_t>& word) {
+#if defined(_WIN32)
+			WakeByAddressAll(reinterpret_cast<PVOID>(&word));
+#elif defined(__linux__)
+			syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAKE_PRIVATE, INT32_MAX, nullptr, nullptr, 0);
+#else
+			word.notify_all();
+#endif
+		}
+	}
+}
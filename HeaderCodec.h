@@ -0,0 +1,122 @@
+#pragma once
+
+#include <cstring>
+#include <stdint.h>
+
+#include "./IMessage.h"
+#include "./Message.h"
+
+
+namespace xpo {
+	namespace net {
+		// Describes how a header is laid out on the wire.
+		// Connections never touch header bytes directly, they go through the codec of the message's header type.
+		//
+		// min_size         - the least amount of bytes any encoded header takes
+		// max_size         - the most amount of bytes any encoded header takes
+		// encoded_size()   - given at least min_size bytes, returns the size of the whole encoded header, 0 if it's invalid.
+		//                    if `available` isn't enough to tell, returns a lower bound larger than `available`;
+		//                    read up to it and ask again
+		// encode()         - writes the header to `out` (which must hold max_size bytes), returns the bytes written, 0 if it can't be encoded
+		// decode()         - reads a header from `data`, returns the bytes consumed, 0 if there aren't enough bytes or it's invalid
+		//
+		// The default codec sends the header object as is.
+		template <IMessageHeader H, class = void>
+		struct HeaderCodec {
+			static constexpr size_t const min_size = sizeof(H);
+			static constexpr size_t const max_size = sizeof(H);
+
+			static size_t encoded_size(uint8_t const* data, size_t available) {
+				return sizeof(H);
+			}
+
+			static size_t encode(H const& header, uint8_t* out) {
+				std::memcpy(out, &header, sizeof(H));
+				return sizeof(H);
+			}
+
+			static size_t decode(H& header, uint8_t const* data, size_t available) {
+				if (available < sizeof(H)) {
+					return 0;
+				}
+				std::memcpy(&header, data, sizeof(H));
+				return sizeof(H);
+			}
+		};
+
+		// Compact header codec.
+		// The command id and then the body size are written as little endian base 128 varints
+		// (7 bits per byte, the high bit marks that another byte follows), each taking 1 or 2 bytes.
+		// That makes the header 2 to 4 bytes long, for ids and body sizes up to 16383.
+		template <class T>
+		struct HeaderCodec<CompactMessageHeader<T>> {
+			static constexpr size_t const min_size = 2;
+			static constexpr size_t const max_size = 4;
+			static constexpr uint32_t const max_value = (1 << 14) - 1;
+
+			static size_t encoded_size(uint8_t const* data, size_t available) {
+				size_t idSize = varint_size(data[0]);
+				if (available <= idSize) {
+					// the size hasn't started yet, we need at least one more byte to tell how long it is
+					return idSize + 1;
+				}
+				return idSize + varint_size(data[idSize]);
+			}
+
+			static size_t encode(CompactMessageHeader<T> const& header, uint8_t* out) {
+				uint32_t id = static_cast<uint32_t>(header.m_id);
+				if (id > max_value || header.m_size > max_value) {
+					return 0;
+				}
+				size_t count = write_varint(id, out);
+				return count + write_varint(header.m_size, out + count);
+			}
+
+			static size_t decode(CompactMessageHeader<T>& header, uint8_t const* data, size_t available) {
+				uint32_t id, size;
+				size_t idSize = read_varint(data, available, id);
+				if (idSize == 0) {
+					return 0;
+				}
+				size_t sizeSize = read_varint(data + idSize, available - idSize, size);
+				if (sizeSize == 0) {
+					return 0;
+				}
+				header.m_id = static_cast<T>(id);
+				header.m_size = size;
+				return idSize + sizeSize;
+			}
+
+		private:
+			static size_t varint_size(uint8_t first) {
+				return (first & 0x80) ? 2 : 1;
+			}
+
+			static size_t write_varint(uint32_t value, uint8_t* out) {
+				if (value < 0x80) {
+					out[0] = static_cast<uint8_t>(value);
+					return 1;
+				}
+				out[0] = static_cast<uint8_t>(value | 0x80);
+				out[1] = static_cast<uint8_t>(value >> 7);
+				return 2;
+			}
+
+			static size_t read_varint(uint8_t const* data, size_t available, uint32_t& value) {
+				if (available == 0) {
+					return 0;
+				}
+				if (!(data[0] & 0x80)) {
+					value = data[0];
+					return 1;
+				}
+				// a second byte with its high bit set would make a 3 byte varint, which we never write
+				if (available < 2 || (data[1] & 0x80)) {
+					return 0;
+				}
+				value = (data[0] & 0x7F) | (uint32_t(data[1]) << 7);
+				return 2;
+			}
+		};
+	}
+}
@@ -1,19 +1,58 @@
 #pragma once
 
 #include <stdint.h>
-#include <functional>
+#include <span>
 #include <system_error>
 
+#include "./InplaceFunction.h"
+
+#ifndef ASYNC_IO_MAX_BUFFERS
+#define ASYNC_IO_MAX_BUFFERS 64
+#endif
+
+// bytes a completion handler may capture, enough for `this` and a few values
+#ifndef ASYNC_IO_CALLBACK_SIZE
+#define ASYNC_IO_CALLBACK_SIZE (4 * sizeof(void*))
+#endif
+
+// bytes a task passed to execute_async() may capture before it spills to the heap, enough for a queued message
+#ifndef ASYNC_IO_TASK_SIZE
+#define ASYNC_IO_TASK_SIZE 192
+#endif
+
 namespace xpo {
 	namespace net {
+		// one piece of a gather write, like an iovec
+		template <class IOType>
+		struct ConstBuffer {
+			IOType const* data;
+			std::size_t size;
+		};
+
+		using ConstByteBuffer = ConstBuffer<uint8_t>;
+
+		// completion handlers never allocate, one capturing more than ASYNC_IO_CALLBACK_SIZE bytes doesn't compile
+		using IOCallback = InplaceFunction<void(std::error_code, std::size_t), ASYNC_IO_CALLBACK_SIZE>;
+
+		using IOTask = InplaceFunction<void(), ASYNC_IO_TASK_SIZE, true>;
+
 		template <class IOType>
 		struct IAsyncIO {
 		public:
-			virtual void execute_async(std::function<void()> f) = 0;
+			virtual void execute_async(IOTask f) = 0;
+
+			virtual void read_async(IOType* const buffer, std::size_t count, IOCallback callback) = 0;
 
-			virtual void read_async(IOType* const buffer, std::size_t count, std::function<void(std::error_code, std::size_t)> callback) = 0;
+			// completes as soon as some data arrived, with up to `count` bytes
+			virtual void read_some_async(IOType* const buffer, std::size_t count, IOCallback callback) = 0;
 
-			virtual void write_async(IOType* const buffer, std::size_t count, std::function<void(std::error_code, std::size_t)> callback) = 0;
+			virtual void write_async(IOType* const buffer, std::size_t count, IOCallback callback) = 0;
+
+			// writes all the buffers, in order, as a single operation (one datagram for datagram sockets).
+			// takes up to ASYNC_IO_MAX_BUFFERS buffers, more fail with ErrorCode::MessageTooLarge.
+			// only one gather write may be in flight at a time.
+			// the memory the buffers point to must stay alive until the callback runs.
+			virtual void write_async(std::span<ConstBuffer<IOType> const> buffers, IOCallback callback) = 0;
 
 			virtual void close() = 0;
 
@@ -21,5 +60,17 @@ namespace xpo {
 		};
 
 		using IAsyncByteIO = IAsyncIO<uint8_t>;
+
+		// the same operations as IAsyncByteIO, without the virtual calls: the callbacks may be any callable,
+		// and a backend taking them as templates passes them down without erasing their type
+		template <class T>
+		concept IStaticAsyncByteIO = requires (T io, uint8_t* buffer, std::size_t count, std::span<ConstByteBuffer const> buffers) {
+			io.execute_async([]() {});
+			io.read_async(buffer, count, [](std::error_code, std::size_t) {});
+			io.read_some_async(buffer, count, [](std::error_code, std::size_t) {});
+			io.write_async(buffers, [](std::error_code, std::size_t) {});
+			io.close();
+			{ io.is_open() } -> std::same_as<bool>;
+		};
 	}
 }
\ No newline at end of file
@@ -23,6 +23,7 @@ namespace xpo {
 			requires IMessageHeader<typename T::header_type>;
 			{ msg.data() } -> std::convertible_to<uint8_t*>;
 			msg.add_data(std::declval<uint8_t*>(), std::declval<std::size_t>());
+			msg.resize(std::declval<std::size_t>()); // sets the body size, so it can be filled in place through data()
 			msg.clear();
 		};
 
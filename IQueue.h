@@ -2,25 +2,44 @@
 
 #include <type_traits>
 #include <concepts>
+#include <vector>
 
 
 namespace xpo {
 	namespace net {
+		// what a bounded queue does with an item pushed while it's full
+		enum class OverflowPolicy {
+			Block,		// the pusher waits for room
+			DropNewest,	// the pushed item is dropped
+			DropOldest,	// the item at the front is dropped to make room
+			Collapse,	// the pushed item replaces the queued one with the same key, or is dropped if there is none
+		};
+
+		// what became of a pushed item
+		enum class PushResult {
+			Queued,
+			Waited,			// queued, after waiting for room
+			Dropped,		// not queued, the queue was full
+			DroppedOldest,	// queued, the oldest item was dropped for it
+			Collapsed,		// took the place of a queued item with the same key, connections fall back to the oldest one
+		};
+
 		template <class T, class Ty>
-		concept IQueue = requires (T q, Ty & v, Ty const& vc) {
+		concept IQueue = requires (T q, Ty & v, Ty const& vc, std::vector<Ty>& batch) {
 			{ q.front() } -> std::same_as<Ty const&>;
-			q.push_front(v);
+			q.push_back(v);
 			{ q.empty() } -> std::same_as<bool>;
 			{ q.size() } -> std::same_as<std::size_t>;
 			q.clear();
 			{ q.pop_front() } -> std::same_as<Ty>;
+			{ q.drain_into(batch, std::size_t{}) } -> std::same_as<std::size_t>; // moves up to N items from the front into the container
 		};
 
 		template <class T, class Ty>
 		concept IDeque = requires (T q, Ty & v, Ty const& vc) {
 			requires IQueue<T, Ty>;
 			{ q.back() } -> std::same_as<Ty const&>;
-			q.push_back(v);
+			q.push_front(v);
 			{ q.pop_back() } -> std::same_as<Ty>;
 		};
 	}
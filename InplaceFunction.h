@@ -0,0 +1,131 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+
+namespace xpo {
+	namespace net {
+		template <class Signature, std::size_t Capacity, bool HeapFallback = false>
+		class InplaceFunction;
+
+		// Move only std::function that keeps the callable inside itself, in Capacity bytes.
+		// Callables that don't fit are a compile error, unless HeapFallback is set, then they go on the heap like std::function.
+		// Used for completion handlers, so re-arming a read or a write never allocates.
+		template <class R, class... Args, std::size_t Capacity, bool HeapFallback>
+		class InplaceFunction<R(Args...), Capacity, HeapFallback> {
+		public:
+			static constexpr std::size_t const capacity = Capacity;
+
+			template <class F>
+			static constexpr bool fits_inline = sizeof(F) <= Capacity
+				&& alignof(F) <= alignof(std::max_align_t)
+				&& std::is_nothrow_move_constructible_v<F>;
+
+			InplaceFunction() = default;
+
+			InplaceFunction(std::nullptr_t) {}
+
+			template <class F, class D = std::decay_t<F>>
+			requires (!std::is_same_v<D, InplaceFunction>) && std::is_invocable_r_v<R, D&, Args...>
+			InplaceFunction(F&& f) {
+				if constexpr (fits_inline<D>) {
+					new (m_storage) D(std::forward<F>(f));
+					m_ops = &inline_ops<D>;
+				}
+				else {
+					static_assert(HeapFallback, "callable doesn't fit in the InplaceFunction, capture less or raise its capacity");
+					new (m_storage) D*(new D(std::forward<F>(f)));
+					m_ops = &heap_ops<D>;
+				}
+			}
+
+			InplaceFunction(InplaceFunction&& other) noexcept {
+				take(other);
+			}
+
+			InplaceFunction& operator=(InplaceFunction&& other) noexcept {
+				if (this != &other) {
+					reset();
+					take(other);
+				}
+				return *this;
+			}
+
+			InplaceFunction& operator=(std::nullptr_t) noexcept {
+				reset();
+				return *this;
+			}
+
+			InplaceFunction(InplaceFunction const&) = delete;
+			InplaceFunction& operator=(InplaceFunction const&) = delete;
+
+			~InplaceFunction() {
+				reset();
+			}
+
+			explicit operator bool() const {
+				return m_ops != nullptr;
+			}
+
+			R operator()(Args... args) {
+				return m_ops->invoke(m_storage, std::forward<Args>(args)...);
+			}
+
+		private:
+			struct Ops {
+				R(*invoke)(void*, Args&&...);
+				void(*move)(void* to, void* from) noexcept;
+				void(*destroy)(void*) noexcept;
+			};
+
+			template <class D>
+			static constexpr Ops const inline_ops = {
+				[](void* self, Args&&... args) -> R {
+					return std::invoke(*static_cast<D*>(self), std::forward<Args>(args)...);
+				},
+				[](void* to, void* from) noexcept {
+					new (to) D(std::move(*static_cast<D*>(from)));
+					static_cast<D*>(from)->~D();
+				},
+				[](void* self) noexcept {
+					static_cast<D*>(self)->~D();
+				},
+			};
+
+			template <class D>
+			static constexpr Ops const heap_ops = {
+				[](void* self, Args&&... args) -> R {
+					return std::invoke(**static_cast<D**>(self), std::forward<Args>(args)...);
+				},
+				[](void* to, void* from) noexcept {
+					new (to) D*(*static_cast<D**>(from));
+				},
+				[](void* self) noexcept {
+					delete *static_cast<D**>(self);
+				},
+			};
+
+			void take(InplaceFunction& other) noexcept {
+				if (other.m_ops != nullptr) {
+					other.m_ops->move(m_storage, other.m_storage);
+					m_ops = other.m_ops;
+					other.m_ops = nullptr;
+				}
+			}
+
+			void reset() noexcept {
+				if (m_ops != nullptr) {
+					m_ops->destroy(m_storage);
+					m_ops = nullptr;
+				}
+			}
+
+			alignas(std::max_align_t) unsigned char m_storage[Capacity < sizeof(void*) ? sizeof(void*) : Capacity];
+			Ops const* m_ops = nullptr;
+		};
+	}
+}
@@ -0,0 +1,321 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <system_error>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include <stdint.h>
+
+#include "./Futex.h"
+#include "./IMessage.h"
+
+#define LOG_LEVEL_TRACE 0
+#define LOG_LEVEL_DEBUG 1
+#define LOG_LEVEL_INFO 2
+#define LOG_LEVEL_WARN 3
+#define LOG_LEVEL_ERROR 4
+#define LOG_LEVEL_OFF 5
+
+// log calls below this level are compiled out, their arguments aren't even evaluated
+#ifndef LOG_LEVEL
+#ifdef NDEBUG
+#define LOG_LEVEL LOG_LEVEL_INFO
+#else
+#define LOG_LEVEL LOG_LEVEL_DEBUG
+#endif
+#endif
+
+// records each logging thread can have waiting for the writer, past that new ones are dropped and counted
+#ifndef LOG_RING_CAPACITY
+#define LOG_RING_CAPACITY 1024
+#endif
+
+// bytes the arguments of one log call may take, a call passing more doesn't compile
+#ifndef LOG_RECORD_SIZE
+#define LOG_RECORD_SIZE 96
+#endif
+
+// how often the writer thread wakes up to write what was logged
+#ifndef LOG_FLUSH_INTERVAL_MS
+#define LOG_FLUSH_INTERVAL_MS 10
+#endif
+
+// NET_LOG_INFO("Received ", msg, " from ", endPoint);
+// the arguments are copied as they are and formatted later on the writer thread, with operator<<.
+// messages are logged by their header, error codes by their message, char pointers are kept as pointers,
+// so pass string literals or std::strings, never a pointer into a buffer that may change.
+#define NET_LOG(level, ...) \
+	do { \
+		if constexpr ((level) >= LOG_LEVEL) { \
+			::xpo::net::Logger::instance().write(static_cast<::xpo::net::LogLevel>(level), __VA_ARGS__); \
+		} \
+	} while (false)
+
+#define NET_LOG_TRACE(...) NET_LOG(LOG_LEVEL_TRACE, __VA_ARGS__)
+#define NET_LOG_DEBUG(...) NET_LOG(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#define NET_LOG_INFO(...) NET_LOG(LOG_LEVEL_INFO, __VA_ARGS__)
+#define NET_LOG_WARN(...) NET_LOG(LOG_LEVEL_WARN, __VA_ARGS__)
+#define NET_LOG_ERROR(...) NET_LOG(LOG_LEVEL_ERROR, __VA_ARGS__)
+
+
+namespace xpo {
+	namespace net {
+		enum class LogLevel : int {
+			Trace = LOG_LEVEL_TRACE,
+			Debug = LOG_LEVEL_DEBUG,
+			Info = LOG_LEVEL_INFO,
+			Warn = LOG_LEVEL_WARN,
+			Error = LOG_LEVEL_ERROR,
+			Off = LOG_LEVEL_OFF
+		};
+
+		inline char const* log_level_name(LogLevel level) {
+			switch (level) {
+			case LogLevel::Trace: return "TRACE";
+			case LogLevel::Debug: return "DEBUG";
+			case LogLevel::Info: return "INFO";
+			case LogLevel::Warn: return "WARN";
+			case LogLevel::Error: return "ERROR";
+			default: return "";
+			}
+		}
+
+		// what a log record keeps of a message, printed the way MessageBase prints itself
+		template <IMessageHeader H>
+		struct LoggedHeader {
+			H header;
+
+			friend std::ostream& operator << (std::ostream& os, LoggedHeader const& logged) {
+				os << "ID:" << int(logged.header.m_id) << " Size:" << logged.header.size();
+				return os;
+			}
+		};
+
+		struct LoggedError {
+			std::error_code ec;
+
+			friend std::ostream& operator << (std::ostream& os, LoggedError const& logged) {
+				os << logged.ec.message();
+				return os;
+			}
+		};
+
+		// turns a log argument into what the record stores
+		template <class V>
+		auto log_capture(V&& v) {
+			using D = std::decay_t<V>;
+			if constexpr (IByteMessage<D>) {
+				return LoggedHeader<typename D::header_type>{ v.header };
+			}
+			else if constexpr (std::is_same_v<D, std::error_code>) {
+				return LoggedError{ v };
+			}
+			else {
+				return D(std::forward<V>(v));
+			}
+		}
+
+		// One log call, with its arguments copied in place.
+		struct LogRecord {
+			using clock = std::chrono::steady_clock;
+
+			LogLevel level;
+			clock::time_point time;
+			void(*format)(std::ostream&, void*);
+			void(*destroy)(void*) noexcept;
+			alignas(std::max_align_t) unsigned char args[LOG_RECORD_SIZE];
+		};
+
+		// Single producer/single consumer ring of records, one per logging thread.
+		// The owning thread pushes, the writer thread pops, neither ever waits for the other:
+		// when the ring is full the record is dropped and counted instead.
+		class LogBuffer {
+		public:
+			LogBuffer()
+				: m_records(new LogRecord[LOG_RING_CAPACITY])
+			{}
+
+			template <class Tuple>
+			bool push(LogLevel level, Tuple&& args) {
+				using D = std::decay_t<Tuple>;
+				static_assert(sizeof(D) <= LOG_RECORD_SIZE && alignof(D) <= alignof(std::max_align_t), "log arguments don't fit in a record, log less or raise LOG_RECORD_SIZE");
+
+				size_t tail = m_tail.load(std::memory_order_relaxed);
+				if (tail - m_head.load(std::memory_order_acquire) == LOG_RING_CAPACITY) {
+					m_dropped.fetch_add(1, std::memory_order_relaxed);
+					return false;
+				}
+				LogRecord& record = m_records[tail % LOG_RING_CAPACITY];
+				record.level = level;
+				record.time = LogRecord::clock::now();
+				new (record.args) D(std::forward<Tuple>(args));
+				record.format = [](std::ostream& os, void* p) {
+					std::apply([&os](auto const&... values) {
+						(os << ... << values);
+					}, *static_cast<D*>(p));
+				};
+				record.destroy = [](void* p) noexcept {
+					static_cast<D*>(p)->~D();
+				};
+				m_tail.store(tail + 1, std::memory_order_release);
+				return true;
+			}
+
+			// calls f(LogRecord&) for every waiting record, then frees them. writer thread only.
+			template <class F>
+			size_t drain(F&& f) {
+				size_t head = m_head.load(std::memory_order_relaxed);
+				size_t tail = m_tail.load(std::memory_order_acquire);
+				for (size_t i = head; i < tail; ++i) {
+					LogRecord& record = m_records[i % LOG_RING_CAPACITY];
+					f(record);
+					record.destroy(record.args);
+				}
+				m_head.store(tail, std::memory_order_release);
+				return tail - head;
+			}
+
+			size_t size() const {
+				return m_tail.load(std::memory_order_relaxed) - m_head.load(std::memory_order_relaxed);
+			}
+
+			size_t take_dropped() {
+				return m_dropped.exchange(0, std::memory_order_relaxed);
+			}
+
+		private:
+			std::unique_ptr<LogRecord[]> m_records;
+			alignas(64) std::atomic<size_t> m_head = 0;
+			alignas(64) std::atomic<size_t> m_tail = 0;
+			std::atomic<size_t> m_dropped = 0;
+		};
+
+		// Process wide logger.
+		// Logging only copies the arguments into the calling thread's LogBuffer, formatting and writing happen on
+		// a background thread every LOG_FLUSH_INTERVAL_MS, or sooner when a buffer gets half full.
+		// Use it through the NET_LOG_* macros, so that levels below LOG_LEVEL cost nothing.
+		class Logger {
+		public:
+			static Logger& instance() {
+				static Logger logger;
+				return logger;
+			}
+
+			Logger(Logger const&) = delete;
+
+			~Logger() {
+				m_running.store(false, std::memory_order_relaxed);
+				wake();
+				m_writer.join();
+				write_pending();
+			}
+
+			template <class... Args>
+			void write(LogLevel level, Args&&... args) {
+				LogBuffer& buffer = thread_buffer();
+				buffer.push(level, std::make_tuple(log_capture(std::forward<Args>(args))...));
+				if (buffer.size() == LOG_RING_CAPACITY / 2) {
+					wake();
+				}
+			}
+
+			// where the writer thread writes to, std::cout by default. the stream must outlive the logger.
+			void output(std::ostream& os) {
+				m_output.store(&os, std::memory_order_relaxed);
+			}
+
+			// writes everything logged so far before returning
+			void flush() {
+				std::lock_guard<std::mutex> lock(m_writeMutex);
+				write_pending();
+			}
+
+		private:
+			Logger()
+				: m_start(LogRecord::clock::now())
+				, m_output(&std::cout)
+				, m_writer([this]() { run(); })
+			{}
+
+			LogBuffer& thread_buffer() {
+				// the writer keeps a buffer alive after its thread exits, until everything in it is written
+				thread_local std::shared_ptr<LogBuffer> buffer = register_buffer();
+				return *buffer;
+			}
+
+			std::shared_ptr<LogBuffer> register_buffer() {
+				auto buffer = std::make_shared<LogBuffer>();
+				std::lock_guard<std::mutex> lock(m_buffersMutex);
+				m_buffers.push_back(buffer);
+				return buffer;
+			}
+
+			void wake() {
+				m_signal.fetch_add(1, std::memory_order_release);
+				futex_wake_one(m_signal);
+			}
+
+			void run() {
+				while (m_running.load(std::memory_order_relaxed)) {
+					uint32_t signal = m_signal.load(std::memory_order_acquire);
+					{
+						std::lock_guard<std::mutex> lock(m_writeMutex);
+						write_pending();
+					}
+					futex_wait_for(m_signal, signal, std::chrono::milliseconds(LOG_FLUSH_INTERVAL_MS));
+				}
+			}
+
+			void write_pending() {
+				{
+					std::lock_guard<std::mutex> lock(m_buffersMutex);
+					m_draining.assign(m_buffers.begin(), m_buffers.end());
+				}
+				std::ostream& os = *m_output.load(std::memory_order_relaxed);
+				size_t written = 0;
+				for (auto& buffer : m_draining) {
+					written += buffer->drain([this, &os](LogRecord& record) {
+						auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(record.time - m_start).count();
+						os << '[' << ms << "ms] [" << log_level_name(record.level) << "] ";
+						record.format(os, record.args);
+						os << '\n';
+					});
+					if (size_t dropped = buffer->take_dropped()) {
+						os << "[" << log_level_name(LogLevel::Warn) << "] " << dropped << " log records dropped, the writer fell behind\n";
+						++written;
+					}
+				}
+				if (written > 0) {
+					os.flush();
+				}
+
+				// buffers of threads that exited go away once they're empty
+				m_draining.clear();
+				std::lock_guard<std::mutex> lock(m_buffersMutex);
+				m_buffers.erase(std::remove_if(m_buffers.begin(), m_buffers.end(), [](auto const& buffer) {
+					return buffer.use_count() == 1 && buffer->size() == 0;
+				}), m_buffers.end());
+			}
+
+			LogRecord::clock::time_point m_start;
+			std::atomic<std::ostream*> m_output;
+			std::atomic<bool> m_running = true;
+			std::atomic<uint32_t> m_signal = 0;
+			std::mutex m_buffersMutex;
+			std::mutex m_writeMutex;
+			std::vector<std::shared_ptr<LogBuffer>> m_buffers;
+			std::vector<std::shared_ptr<LogBuffer>> m_draining;
+			std::thread m_writer;
+		};
+	}
+}
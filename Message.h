@@ -1,6 +1,14 @@
 #pragma once
 
+#include <algorithm>
+#include <cstring>
+#include <span>
+#include <string_view>
+#include <tuple>
+
+#include "./BufferPool.h"
 #include "./IMessage.h"
+#include "./SmallBuffer.h"
 
 
 namespace xpo {
@@ -28,17 +36,36 @@ namespace xpo {
 
 			typedef T commands;
 
-			size_t size() {
+			size_t size() const {
+				return m_size;
+			}
+		};
+
+		// message bodies that recycle their storage through the buffer pool instead of the heap
+		using PooledBody = std::vector<uint8_t, PoolAllocator<uint8_t>>;
+
+		// In memory layout of a header that travels compactly on the wire, see HeaderCodec.h
+		template <class T>
+		requires std::is_enum_v<T>
+			struct CompactMessageHeader
+		{
+			uint32_t m_size;
+			T m_id;
+
+			typedef T commands;
+
+			size_t size() const {
 				return m_size;
 			}
 		};
 
-		template <IMessageHeader T>
+		template <IMessageHeader T, class Body = std::vector<uint8_t>>
 		struct MessageBase {
 			T header{};
-			std::vector<uint8_t> m_body;
+			Body m_body;
 
 			typedef T header_type;
+			typedef Body body_type;
 
 			uint8_t* data() {
 				return m_body.data();
@@ -50,23 +77,31 @@ namespace xpo {
 				std::memcpy(m_body.data() + lastSize, data, length);
 			}
 
+			void resize(size_t length) {
+				m_body.resize(length);
+			}
+
 			void clear() {
 				m_body.clear();
 			}
 
+			std::span<const uint8_t> body() const {
+				return { m_body.data(), m_body.size() };
+			}
+
 			template <class DataType>
-			friend MessageBase<T>& operator << (MessageBase<T>& msg, DataType const& data) {
-				SerializeType<DataType, MessageBase<T>>::write(msg, data);
+			friend MessageBase& operator << (MessageBase& msg, DataType const& data) {
+				SerializeType<DataType, MessageBase>::write(msg, data);
 				return msg;
 			}
 
 			template <class DataType>
-			friend MessageBase<T>& operator >> (MessageBase<T>& msg, DataType& data) {
-				SerializeType<DataType, MessageBase<T>>::read(msg, data);
+			friend MessageBase& operator >> (MessageBase& msg, DataType& data) {
+				SerializeType<DataType, MessageBase>::read(msg, data);
 				return msg;
 			}
 
-			friend std::ostream& operator << (std::ostream& os, MessageBase<T> const& msg) {
+			friend std::ostream& operator << (std::ostream& os, MessageBase const& msg) {
 				os << "ID:" << int(msg.header.m_id) << " Size:" << msg.header.m_size;
 				return os;
 			}
@@ -76,13 +111,101 @@ namespace xpo {
 		requires std::is_enum_v<T>
 			using Message = MessageBase<MessageHeader<T>>;
 
+		template <class T>
+		requires std::is_enum_v<T>
+			using PooledMessage = MessageBase<MessageHeader<T>, PooledBody>;
+
+		// message bodies of up to N bytes live inside the message, bigger ones spill to the buffer pool
+		template <std::size_t N = SMALL_MESSAGE_INLINE_SIZE>
+		using SmallBody = SmallBuffer<N, PoolAllocator<uint8_t>>;
+
+		template <class T, std::size_t N = SMALL_MESSAGE_INLINE_SIZE>
+		requires std::is_enum_v<T>
+			using SmallMessage = MessageBase<MessageHeader<T>, SmallBody<N>>;
+
+		template <class T>
+		requires std::is_enum_v<T>
+			using CompactMessage = MessageBase<CompactMessageHeader<T>>;
+
+		template <class T>
+		requires std::is_enum_v<T>
+			using PooledCompactMessage = MessageBase<CompactMessageHeader<T>, PooledBody>;
+
+		// Contiguous sequences get their own serializers and must not be memcpy'd as plain objects
+		template <class T>
+		struct is_sequence_type : std::false_type {};
+
+		template <class CharT, class Traits, class Alloc>
+		struct is_sequence_type<std::basic_string<CharT, Traits, Alloc>> : std::true_type {};
+
+		template <class CharT, class Traits>
+		struct is_sequence_type<std::basic_string_view<CharT, Traits>> : std::true_type {};
+
+		template <class T, class Alloc>
+		struct is_sequence_type<std::vector<T, Alloc>> : std::true_type {};
+
+		template <class T, std::size_t Extent>
+		struct is_sequence_type<std::span<T, Extent>> : std::true_type {};
+
+		template <class T>
+		constexpr bool is_sequence_type_v = is_sequence_type<T>::value;
+
+		// A type is reflected when it lists its serialized fields as member pointers, in wire order:
+		//     static constexpr auto fields = std::make_tuple(&Player::id, &Player::position, &Player::name);
+		// Reflected types are serialized field by field (see Reflection.h), never as raw memory.
+		template <class T>
+		concept Reflected = requires {
+			std::tuple_size<std::remove_cvref_t<decltype(T::fields)>>::value;
+		};
+
+		// values whose memory is their encoding, arrays of them are copied in bulk
+		template <class T>
+		constexpr bool is_raw_serializable_v = std::is_trivially_copyable_v<T> && !is_sequence_type_v<T> && !Reflected<T>;
+
 #ifndef GAMECORE_NET_OVERRIDE_DEFAULT_SERIALIZER_IMPLEMENTATION
 
+		// Appends `count` trivially copyable elements followed by their count, sizing the body once.
+		// This is the same layout as writing every element and then the count one by one.
+		template <class DataType, IMessageHeader H, class B>
+		void write_contiguous(MessageBase<H, B>& msg, DataType const* data, size_t count) {
+			static_assert(is_raw_serializable_v<DataType>);
+			int length = static_cast<int>(count);
+			size_t bytes = count * sizeof(DataType);
+			size_t i = msg.m_body.size();
+			msg.m_body.resize(i + bytes + sizeof(length));
+
+			if (bytes > 0) {
+				std::memcpy(msg.m_body.data() + i, data, bytes);
+			}
+			std::memcpy(msg.m_body.data() + i + bytes, &length, sizeof(length));
+
+			msg.header.m_size = msg.m_body.size();
+		}
+
+		// Pops the count and returns where the elements start, or nullptr if the body is too short for them
+		template <class DataType, IMessageHeader H, class B>
+		uint8_t const* read_contiguous(MessageBase<H, B>& msg, size_t& count) {
+			int length;
+			msg >> length;
+			size_t bytes = static_cast<size_t>(length) * sizeof(DataType);
+			if (length < 0 || bytes > msg.m_body.size()) {
+				count = 0;
+				return nullptr;
+			}
+
+			count = static_cast<size_t>(length);
+			size_t i = msg.m_body.size() - bytes;
+			// shrinking never reallocates, so the bytes stay in place until the next write
+			msg.m_body.resize(i);
+			msg.header.m_size = i;
+			return msg.m_body.data() + i;
+		}
+
 		// Standard layout object serialization implementation
-		template <class DataType, IMessageHeader H>
-		struct SerializeType<DataType, MessageBase<H>, std::enable_if_t<std::is_standard_layout_v<DataType>>>
+		template <class DataType, IMessageHeader H, class B>
+		struct SerializeType<DataType, MessageBase<H, B>, std::enable_if_t<std::is_standard_layout_v<DataType> && !is_sequence_type_v<DataType> && !Reflected<DataType>>>
 		{
-			static void write(MessageBase<H>& msg, DataType const& data) {
+			static void write(MessageBase<H, B>& msg, DataType const& data) {
 				//static_assert(std::is_standard_layout<DataType>::value, "Data is too complex to poped from vector");
 				size_t i = msg.m_body.size();
 				msg.m_body.resize(i + sizeof(DataType));
@@ -92,7 +215,7 @@ namespace xpo {
 				msg.header.m_size = msg.m_body.size();
 			}
 
-			static void read(MessageBase<H>& msg, DataType& data) {
+			static void read(MessageBase<H, B>& msg, DataType& data) {
 				//static_assert(std::is_standard_layout<DataType>::value, "Data is too complex to poped from vector");
 				size_t i = msg.m_body.size() - sizeof(DataType);
 
@@ -105,60 +228,114 @@ namespace xpo {
 		};
 
 		// String serialization implementation
-		template <IMessageHeader H>
-		struct SerializeType<std::string, MessageBase<H>> {
-			static void write(MessageBase<H>& msg, std::string const& data) {
-				for (char c : data) {
-					msg << c;
+		template <IMessageHeader H, class B>
+		struct SerializeType<std::string, MessageBase<H, B>> {
+			static void write(MessageBase<H, B>& msg, std::string const& data) {
+				write_contiguous(msg, data.data(), data.size());
+			}
+
+			static void read(MessageBase<H, B>& msg, std::string& data) {
+				size_t length;
+				uint8_t const* chars = read_contiguous<char>(msg, length);
+				if (chars != nullptr) {
+					data.insert(0, reinterpret_cast<char const*>(chars), length);
 				}
-				int length = data.size();;
-				msg << length;
 			}
+		};
 
-			static void read(MessageBase<H>& msg, std::string& data) {
-				int length;
-				char c;
-				msg >> length;
-				for (int i = 0; i < length; i++) {
-					msg >> c;
-					data.insert(data.begin(), c);
+		// String view serialization implementation (write only, read it back as a std::string)
+		template <IMessageHeader H, class B>
+		struct SerializeType<std::string_view, MessageBase<H, B>> {
+			static void write(MessageBase<H, B>& msg, std::string_view const& data) {
+				write_contiguous(msg, data.data(), data.size());
+			}
+		};
+
+		// Span serialization implementation (write only, read it back as a std::vector)
+		template <class DataType, std::size_t Extent, IMessageHeader H, class B>
+		struct SerializeType<std::span<DataType, Extent>, MessageBase<H, B>> {
+			static void write(MessageBase<H, B>& msg, std::span<DataType, Extent> const& data) {
+				if constexpr (is_raw_serializable_v<DataType>) {
+					write_contiguous(msg, data.data(), data.size());
+				}
+				else {
+					for (DataType const& item : data) {
+						msg << item;
+					}
+					int length = static_cast<int>(data.size());
+					msg << length;
 				}
 			}
 		};
 
 		// Vector serialization implementation
-		template <class DataType, IMessageHeader H>
-		struct SerializeType<std::vector<DataType>, MessageBase<H>> {
-			static void write(MessageBase<H>& msg, std::vector<DataType> const& data) {
-				int length = data.size();
-				for (int i = 0; i < length; ++i) {
-					DataType temp = data[i];
-					msg << temp;
+		template <class DataType, IMessageHeader H, class B>
+		struct SerializeType<std::vector<DataType>, MessageBase<H, B>> {
+			// std::vector<bool> packs its items into bits and has no data(), so it goes item by item
+			static constexpr bool const contiguous = is_raw_serializable_v<DataType> && !std::is_same_v<DataType, bool>;
+
+			static void write(MessageBase<H, B>& msg, std::vector<DataType> const& data) {
+				if constexpr (contiguous) {
+					write_contiguous(msg, data.data(), data.size());
+				}
+				else {
+					int length = data.size();
+					for (int i = 0; i < length; ++i) {
+						msg << data[i];
+					}
+					msg << length;
 				}
-				msg << length;
 			}
 
-			static void read(MessageBase<H>& msg, std::vector<DataType>& data) {
-				int length;
-				msg >> length;
-				for (int i = 0; i < length; ++i) {
-					DataType temp;
-					msg >> temp;
-					data.emplace(data.begin(), temp);
+			static void read(MessageBase<H, B>& msg, std::vector<DataType>& data) {
+				if constexpr (contiguous) {
+					size_t length;
+					uint8_t const* items = read_contiguous<DataType>(msg, length);
+					if (items != nullptr) {
+						prepend(data, length);
+						std::memcpy(data.data(), items, length * sizeof(DataType));
+					}
 				}
+				else {
+					// items come out last to first, so fill the new slots backwards
+					int length;
+					msg >> length;
+					if (length < 0) {
+						return;
+					}
+					prepend(data, length);
+					for (int i = length - 1; i >= 0; --i) {
+						if constexpr (std::is_same_v<DataType, bool>) {
+							bool item;
+							msg >> item;
+							data[i] = item;
+						}
+						else {
+							msg >> data[i];
+						}
+					}
+				}
+			}
+
+		private:
+			// opens `count` slots at the front of `data`
+			static void prepend(std::vector<DataType>& data, size_t count) {
+				size_t oldSize = data.size();
+				data.resize(oldSize + count);
+				std::move_backward(data.begin(), data.begin() + oldSize, data.end());
 			}
 		};
 
 		// Serializable serialization implementation
-		template <class DataType, IMessageHeader H>
-		requires Serializable<DataType, MessageBase<H>>
-			struct SerializeType<DataType, MessageBase<H>>
+		template <class DataType, IMessageHeader H, class B>
+		requires Serializable<DataType, MessageBase<H, B>>
+			struct SerializeType<DataType, MessageBase<H, B>>
 		{
-			static void write(MessageBase<H>& msg, DataType const& data) {
+			static void write(MessageBase<H, B>& msg, DataType const& data) {
 				DataType::write(msg, data);
 			}
 
-			static void read(MessageBase<H>& msg, DataType& data) {
+			static void read(MessageBase<H, B>& msg, DataType& data) {
 				DataType::read(msg, data);
 			}
 		};
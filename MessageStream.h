@@ -0,0 +1,341 @@
+#pragma once
+
+#include <cstring>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "./Message.h"
+
+
+namespace xpo {
+	namespace net {
+		// Forward (in order) encoding of message bodies.
+		//
+		// Fields are laid out in the order they are written: fixed size values as their raw bytes,
+		// strings and arrays as a uint32_t element count followed by the elements.
+		// Unlike operator>> on MessageBase, reading never touches the message, so a body can be
+		// inspected any number of times and handed to several handlers. Strings and byte arrays
+		// can be read as views that point straight into the body.
+		//
+		// Fixed size fields written with MessageBase::operator<< read back fine, but strings and
+		// arrays must be written with MessageWriter, since the stack layout stores their count last.
+		template <class DataType, class = void>
+		struct StreamSerializeType;
+
+		class MessageReader {
+		public:
+			MessageReader() = default;
+
+			MessageReader(std::span<const uint8_t> buffer)
+				: m_buffer(buffer)
+			{}
+
+			template <IMessageHeader H, class B>
+			MessageReader(MessageBase<H, B> const& msg)
+				: m_buffer(msg.body())
+			{}
+
+			template <class DataType>
+			MessageReader& operator >> (DataType& data) {
+				if (m_ok) {
+					StreamSerializeType<DataType>::read(*this, data);
+				}
+				return *this;
+			}
+
+			template <class DataType>
+			DataType read() {
+				DataType data{};
+				*this >> data;
+				return data;
+			}
+
+			// returns a view of the next `count` bytes, or an empty span (and fails the reader) if there aren't enough
+			std::span<const uint8_t> read_bytes(size_t count) {
+				if (!m_ok || count > remaining()) {
+					fail();
+					return {};
+				}
+				std::span<const uint8_t> bytes = m_buffer.subspan(m_position, count);
+				m_position += count;
+				return bytes;
+			}
+
+			bool skip(size_t count) {
+				return m_ok && read_bytes(count).size() == count;
+			}
+
+			void rewind() {
+				m_position = 0;
+				m_ok = true;
+			}
+
+			size_t position() const {
+				return m_position;
+			}
+
+			size_t remaining() const {
+				return m_buffer.size() - m_position;
+			}
+
+			std::span<const uint8_t> remaining_bytes() const {
+				return m_buffer.subspan(m_position);
+			}
+
+			std::span<const uint8_t> buffer() const {
+				return m_buffer;
+			}
+
+			// a failed reader ignores every following read
+			void fail() {
+				m_ok = false;
+			}
+
+			bool ok() const {
+				return m_ok;
+			}
+
+			explicit operator bool() const {
+				return m_ok;
+			}
+
+		private:
+			std::span<const uint8_t> m_buffer;
+			size_t m_position = 0;
+			bool m_ok = true;
+		};
+
+		template <IMessageHeader H, class B>
+		class MessageWriter {
+		public:
+			MessageWriter(MessageBase<H, B>& msg)
+				: m_msg(msg)
+			{}
+
+			template <class DataType>
+			MessageWriter& operator << (DataType const& data) {
+				StreamSerializeType<DataType>::write(*this, data);
+				return *this;
+			}
+
+			// makes room for `count` more bytes so the following writes don't grow the body
+			void reserve(size_t count) {
+				m_msg.m_body.reserve(m_msg.m_body.size() + count);
+			}
+
+			// grows the body by `count` bytes and returns where they start
+			uint8_t* append(size_t count) {
+				size_t i = m_msg.m_body.size();
+				m_msg.m_body.resize(i + count);
+				m_msg.header.m_size = m_msg.m_body.size();
+				return m_msg.m_body.data() + i;
+			}
+
+			void write_bytes(void const* data, size_t count) {
+				if (count > 0) {
+					std::memcpy(append(count), data, count);
+				}
+			}
+
+			MessageBase<H, B>& message() {
+				return m_msg;
+			}
+
+		private:
+			MessageBase<H, B>& m_msg;
+		};
+
+		// Writer over memory that was already sized for everything written to it, every write is a plain copy
+		class BufferWriter {
+		public:
+			BufferWriter(uint8_t* out)
+				: m_out(out)
+			{}
+
+			template <class DataType>
+			BufferWriter& operator << (DataType const& data) {
+				StreamSerializeType<DataType>::write(*this, data);
+				return *this;
+			}
+
+			uint8_t* append(size_t count) {
+				uint8_t* out = m_out;
+				m_out += count;
+				return out;
+			}
+
+			void write_bytes(void const* data, size_t count) {
+				if (count > 0) {
+					std::memcpy(append(count), data, count);
+				}
+			}
+
+			uint8_t* position() const {
+				return m_out;
+			}
+
+		private:
+			uint8_t* m_out;
+		};
+
+		// Fixed size object implementation
+		template <class DataType>
+		struct StreamSerializeType<DataType, std::enable_if_t<is_raw_serializable_v<DataType>>> {
+			template <class Writer>
+			static void write(Writer& writer, DataType const& data) {
+				writer.write_bytes(&data, sizeof(DataType));
+			}
+
+			static void read(MessageReader& reader, DataType& data) {
+				std::span<const uint8_t> bytes = reader.read_bytes(sizeof(DataType));
+				if (!bytes.empty()) {
+					std::memcpy(&data, bytes.data(), sizeof(DataType));
+				}
+			}
+		};
+
+		// Contiguous array implementation, shared by the string, span and vector serializers
+		template <class DataType>
+		struct StreamSerializeArray {
+			template <class Writer>
+			static void write(Writer& writer, DataType const* data, size_t count) {
+				uint32_t length = static_cast<uint32_t>(count);
+				if constexpr (is_raw_serializable_v<DataType>) {
+					size_t bytes = count * sizeof(DataType);
+					uint8_t* out = writer.append(sizeof(length) + bytes);
+					std::memcpy(out, &length, sizeof(length));
+					if (bytes > 0) {
+						std::memcpy(out + sizeof(length), data, bytes);
+					}
+				}
+				else {
+					writer << length;
+					for (size_t i = 0; i < count; ++i) {
+						writer << data[i];
+					}
+				}
+			}
+
+			// returns the raw bytes of the next array, without copying them
+			static std::span<const uint8_t> read_view(MessageReader& reader, size_t& count) {
+				static_assert(is_raw_serializable_v<DataType>);
+				uint32_t length = 0;
+				reader >> length;
+				std::span<const uint8_t> bytes = reader.read_bytes(static_cast<size_t>(length) * sizeof(DataType));
+				count = reader ? length : 0;
+				return bytes;
+			}
+		};
+
+		// String implementation
+		template <class CharT, class Traits, class Alloc>
+		struct StreamSerializeType<std::basic_string<CharT, Traits, Alloc>> {
+			template <class Writer>
+			static void write(Writer& writer, std::basic_string<CharT, Traits, Alloc> const& data) {
+				StreamSerializeArray<CharT>::write(writer, data.data(), data.size());
+			}
+
+			static void read(MessageReader& reader, std::basic_string<CharT, Traits, Alloc>& data) {
+				size_t count;
+				std::span<const uint8_t> bytes = StreamSerializeArray<CharT>::read_view(reader, count);
+				data.resize(count);
+				if (count > 0) {
+					std::memcpy(data.data(), bytes.data(), bytes.size());
+				}
+			}
+		};
+
+		// String view implementation, reads point into the message body
+		template <class Traits>
+		struct StreamSerializeType<std::basic_string_view<char, Traits>> {
+			template <class Writer>
+			static void write(Writer& writer, std::basic_string_view<char, Traits> const& data) {
+				StreamSerializeArray<char>::write(writer, data.data(), data.size());
+			}
+
+			static void read(MessageReader& reader, std::basic_string_view<char, Traits>& data) {
+				size_t count;
+				std::span<const uint8_t> bytes = StreamSerializeArray<char>::read_view(reader, count);
+				data = { reinterpret_cast<char const*>(bytes.data()), count };
+			}
+		};
+
+		// Span implementation, reads point into the message body.
+		// The body has no alignment guarantees, so only byte sized elements can be viewed in place.
+		template <class DataType, std::size_t Extent>
+		struct StreamSerializeType<std::span<DataType, Extent>> {
+			template <class Writer>
+			static void write(Writer& writer, std::span<DataType, Extent> const& data) {
+				StreamSerializeArray<std::remove_const_t<DataType>>::write(writer, data.data(), data.size());
+			}
+
+			static void read(MessageReader& reader, std::span<DataType, Extent>& data) {
+				static_assert(std::is_const_v<DataType> && alignof(DataType) == 1 && Extent == std::dynamic_extent,
+					"Only std::span<const T> of byte sized T can view a message body, read a std::vector instead");
+				size_t count;
+				std::span<const uint8_t> bytes = StreamSerializeArray<std::remove_const_t<DataType>>::read_view(reader, count);
+				data = { reinterpret_cast<DataType*>(bytes.data()), count };
+			}
+		};
+
+		// Vector implementation
+		template <class DataType, class Alloc>
+		struct StreamSerializeType<std::vector<DataType, Alloc>> {
+			template <class Writer>
+			static void write(Writer& writer, std::vector<DataType, Alloc> const& data) {
+				StreamSerializeArray<DataType>::write(writer, data.data(), data.size());
+			}
+
+			static void read(MessageReader& reader, std::vector<DataType, Alloc>& data) {
+				if constexpr (is_raw_serializable_v<DataType>) {
+					size_t count;
+					std::span<const uint8_t> bytes = StreamSerializeArray<DataType>::read_view(reader, count);
+					data.resize(count);
+					if (count > 0) {
+						std::memcpy(data.data(), bytes.data(), bytes.size());
+					}
+				}
+				else {
+					uint32_t length = 0;
+					reader >> length;
+					// every element takes at least a byte, don't trust a length the body can't hold
+					if (length > reader.remaining()) {
+						reader.fail();
+					}
+					data.clear();
+					for (uint32_t i = 0; i < length && reader; ++i) {
+						reader >> data.emplace_back();
+					}
+				}
+			}
+		};
+
+		// std::vector<bool> has no data() to copy from, its items go one by one
+		template <class Alloc>
+		struct StreamSerializeType<std::vector<bool, Alloc>> {
+			template <class Writer>
+			static void write(Writer& writer, std::vector<bool, Alloc> const& data) {
+				writer << static_cast<uint32_t>(data.size());
+				for (bool item : data) {
+					writer << item;
+				}
+			}
+
+			static void read(MessageReader& reader, std::vector<bool, Alloc>& data) {
+				uint32_t length = 0;
+				reader >> length;
+				if (length > reader.remaining()) {
+					reader.fail();
+				}
+				data.clear();
+				for (uint32_t i = 0; i < length && reader; ++i) {
+					bool item = false;
+					reader >> item;
+					data.push_back(item);
+				}
+			}
+		};
+	}
+}
@@ -0,0 +1,281 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <stdint.h>
+
+// 0 compiles every counter, gauge and histogram update out, snapshots then read all zeros
+#ifndef NET_METRICS
+#define NET_METRICS 1
+#endif
+
+// one in this many messages has its queue residency and handler latency timed, reading the clock costs more than
+// everything else here together. must be a power of two, 1 times every message.
+#ifndef METRICS_LATENCY_SAMPLE_RATE
+#define METRICS_LATENCY_SAMPLE_RATE 64
+#endif
+
+// log2 of the sub-buckets per power of two in a LatencyHistogram, 4 keeps every bucket within 1/16 of its value
+#ifndef LATENCY_HISTOGRAM_SUB_BUCKET_BITS
+#define LATENCY_HISTOGRAM_SUB_BUCKET_BITS 4
+#endif
+
+// log2 of the largest latency a LatencyHistogram tells apart, in nanoseconds. 36 is about a minute, longer ones land in the last bucket.
+#ifndef LATENCY_HISTOGRAM_MAX_BITS
+#define LATENCY_HISTOGRAM_MAX_BITS 36
+#endif
+
+
+namespace xpo {
+	namespace net {
+		// Metrics have a single writer, the io thread of whatever they measure, and any number of readers.
+		// So updates are a relaxed load and store rather than a locked read-modify-write, and reads never tear.
+
+		// Monotonic count.
+		class MetricCounter {
+		public:
+			void add(uint64_t n = 1) {
+				if constexpr (NET_METRICS) {
+					m_value.store(m_value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+				}
+			}
+
+			// for the odd counter more than one thread adds to, such a counter must only ever use this
+			void add_shared(uint64_t n = 1) {
+				if constexpr (NET_METRICS) {
+					m_value.fetch_add(n, std::memory_order_relaxed);
+				}
+			}
+
+			uint64_t load() const {
+				return m_value.load(std::memory_order_relaxed);
+			}
+
+		private:
+			std::atomic<uint64_t> m_value = 0;
+		};
+
+		// A value that goes up and down, like a queue's depth.
+		class MetricGauge {
+		public:
+			void add(int64_t n = 1) {
+				if constexpr (NET_METRICS) {
+					m_value.store(m_value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+				}
+			}
+
+			void sub(int64_t n = 1) {
+				add(-n);
+			}
+
+			void set(int64_t value) {
+				if constexpr (NET_METRICS) {
+					m_value.store(value, std::memory_order_relaxed);
+				}
+			}
+
+			int64_t load() const {
+				return m_value.load(std::memory_order_relaxed);
+			}
+
+		private:
+			std::atomic<int64_t> m_value = 0;
+		};
+
+		// A copy of a LatencyHistogram, taken at some point while it kept recording.
+		struct HistogramSnapshot {
+			static constexpr size_t const sub_bucket_bits = LATENCY_HISTOGRAM_SUB_BUCKET_BITS;
+			static constexpr size_t const sub_buckets = size_t(1) << sub_bucket_bits;
+			static constexpr size_t const bucket_count = (LATENCY_HISTOGRAM_MAX_BITS - sub_bucket_bits + 1) * sub_buckets;
+
+			uint64_t count = 0;
+			uint64_t sum = 0;
+			uint64_t max = 0;
+			std::array<uint64_t, bucket_count> buckets{};
+
+			// every value below 2^sub_bucket_bits has its own bucket, after that each power of two is split in sub_buckets
+			static size_t bucket_of(uint64_t value) {
+				if (value < sub_buckets) {
+					return static_cast<size_t>(value);
+				}
+				size_t exponent = std::bit_width(value) - 1;
+				size_t bucket = (exponent - sub_bucket_bits + 1) * sub_buckets + static_cast<size_t>((value >> (exponent - sub_bucket_bits)) - sub_buckets);
+				return std::min(bucket, bucket_count - 1);
+			}
+
+			// the largest value that falls in `bucket`
+			static uint64_t bucket_limit(size_t bucket) {
+				if (bucket < sub_buckets) {
+					return bucket;
+				}
+				size_t group = bucket / sub_buckets;
+				uint64_t lower = (uint64_t(sub_buckets) + bucket % sub_buckets) << (group - 1);
+				return lower + (uint64_t(1) << (group - 1)) - 1;
+			}
+
+			double mean() const {
+				return count == 0 ? 0.0 : double(sum) / double(count);
+			}
+
+			// the value `fraction` (0 to 1) of the recorded values are at or below, to the bucket's precision
+			uint64_t percentile(double fraction) const {
+				if (count == 0) {
+					return 0;
+				}
+				uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(fraction * double(count) + 0.5));
+				uint64_t seen = 0;
+				for (size_t i = 0; i < bucket_count; ++i) {
+					seen += buckets[i];
+					if (seen >= rank) {
+						return std::min(bucket_limit(i), max);
+					}
+				}
+				return max;
+			}
+		};
+
+		// Log-linear histogram of durations in nanoseconds, like an HdrHistogram with fixed precision.
+		// Recording is a few relaxed stores and never allocates, snapshot() may run on any thread meanwhile.
+		class LatencyHistogram {
+		public:
+			using clock = std::chrono::steady_clock;
+
+			void record(uint64_t nanoseconds) {
+				if constexpr (NET_METRICS) {
+					auto& bucket = m_buckets[HistogramSnapshot::bucket_of(nanoseconds)];
+					bucket.store(bucket.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+					m_count.store(m_count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+					m_sum.store(m_sum.load(std::memory_order_relaxed) + nanoseconds, std::memory_order_relaxed);
+					if (nanoseconds > m_max.load(std::memory_order_relaxed)) {
+						m_max.store(nanoseconds, std::memory_order_relaxed);
+					}
+				}
+			}
+
+			void record(clock::duration duration) {
+				record(static_cast<uint64_t>(std::max<int64_t>(0, std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count())));
+			}
+
+			// the time since `start`
+			void record_since(clock::time_point start) {
+				record(clock::now() - start);
+			}
+
+			HistogramSnapshot snapshot() const {
+				HistogramSnapshot snapshot;
+				for (size_t i = 0; i < HistogramSnapshot::bucket_count; ++i) {
+					snapshot.buckets[i] = m_buckets[i].load(std::memory_order_relaxed);
+				}
+				snapshot.count = m_count.load(std::memory_order_relaxed);
+				snapshot.sum = m_sum.load(std::memory_order_relaxed);
+				snapshot.max = m_max.load(std::memory_order_relaxed);
+				return snapshot;
+			}
+
+		private:
+			std::array<std::atomic<uint64_t>, HistogramSnapshot::bucket_count> m_buckets{};
+			std::atomic<uint64_t> m_count = 0;
+			std::atomic<uint64_t> m_sum = 0;
+			std::atomic<uint64_t> m_max = 0;
+		};
+
+		struct ConnectionMetricsSnapshot {
+			uint64_t bytesIn = 0;
+			uint64_t packetsIn = 0;
+			uint64_t bytesOut = 0;
+			uint64_t packetsOut = 0;
+			uint64_t headerDrops = 0;
+			uint64_t invalidHeaders = 0;
+			uint64_t receiveFailures = 0;
+			uint64_t sendFailures = 0;
+			uint64_t sendDrops = 0;
+			uint64_t sendCollapses = 0;
+			int64_t outQueueDepth = 0;
+			HistogramSnapshot queueResidency;
+			HistogramSnapshot handlerLatency;
+		};
+
+		// What a connection counts while it runs. Only the io thread updates it, any thread may take a snapshot().
+		// The two histograms only see one in METRICS_LATENCY_SAMPLE_RATE messages.
+		//   bytes in/out      bytes read from and written to the socket, headers included
+		//   packets in/out    messages handed to on_receive() and messages written
+		//   header drops      headers on_receive_header() refused
+		//   invalid headers   frames that didn't parse, reported as ErrorCode::InvalidHeader
+		//   send drops        messages the out queue's overflow policy dropped or collapsed, counted from any thread
+		//   out queue depth   messages waiting to be written
+		//   queue residency   how long a message waited in the out queue before it was written
+		//   handler latency   how long on_receive() took
+		struct ConnectionMetrics {
+			using clock = std::chrono::steady_clock;
+
+			MetricCounter bytesIn;
+			MetricCounter packetsIn;
+			MetricCounter bytesOut;
+			MetricCounter packetsOut;
+			MetricCounter headerDrops;
+			MetricCounter invalidHeaders;
+			MetricCounter receiveFailures;
+			MetricCounter sendFailures;
+			MetricCounter sendDrops;
+			MetricCounter sendCollapses;
+			MetricGauge outQueueDepth;
+			LatencyHistogram queueResidency;
+			LatencyHistogram handlerLatency;
+
+			static_assert((METRICS_LATENCY_SAMPLE_RATE & (METRICS_LATENCY_SAMPLE_RATE - 1)) == 0, "METRICS_LATENCY_SAMPLE_RATE must be a power of two");
+
+			// whether this message is one of the timed ones
+			bool sample() {
+				if constexpr (NET_METRICS) {
+					return (++m_sampleTick & (METRICS_LATENCY_SAMPLE_RATE - 1)) == 0;
+				}
+				return false;
+			}
+
+			// calls handler(), and records how long it took if the message is sampled
+			template <class F>
+			void time_handler(F&& handler) {
+				if (sample()) {
+					auto start = clock::now();
+					handler();
+					handlerLatency.record_since(start);
+				}
+				else {
+					handler();
+				}
+			}
+
+			ConnectionMetricsSnapshot snapshot() const {
+				ConnectionMetricsSnapshot snapshot;
+				snapshot.bytesIn = bytesIn.load();
+				snapshot.packetsIn = packetsIn.load();
+				snapshot.bytesOut = bytesOut.load();
+				snapshot.packetsOut = packetsOut.load();
+				snapshot.headerDrops = headerDrops.load();
+				snapshot.invalidHeaders = invalidHeaders.load();
+				snapshot.receiveFailures = receiveFailures.load();
+				snapshot.sendFailures = sendFailures.load();
+				snapshot.sendDrops = sendDrops.load();
+				snapshot.sendCollapses = sendCollapses.load();
+				snapshot.outQueueDepth = outQueueDepth.load();
+				snapshot.queueResidency = queueResidency.snapshot();
+				snapshot.handlerLatency = handlerLatency.snapshot();
+				return snapshot;
+			}
+
+		private:
+			uint32_t m_sampleTick = 0;
+		};
+
+		// Per-session traffic, counted in message bytes (headers not included).
+		struct SessionMetrics {
+			uint64_t bytesIn = 0;
+			uint64_t packetsIn = 0;
+			uint64_t bytesOut = 0;
+			uint64_t packetsOut = 0;
+		};
+	}
+}
@@ -1,8 +1,8 @@
 #pragma once
 
-#include <iostream>
+#include "./Log.h"
 
 
 void init_protocol() {
-	std::cout << "Protocol Initialized" << std::endl;
+	NET_LOG_INFO("Protocol Initialized");
 }
\ No newline at end of file
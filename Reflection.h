@@ -0,0 +1,193 @@
+#pragma once
+
+#include <cstring>
+#include <span>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "./Message.h"
+#include "./MessageStream.h"
+
+
+namespace xpo {
+	namespace net {
+		// Declarative serialization for structs.
+		//
+		//     struct PlayerState {
+		//         uint32_t id;
+		//         Vector3 position;
+		//         std::string name;
+		//
+		//         static constexpr auto fields = std::make_tuple(&PlayerState::id, &PlayerState::position, &PlayerState::name);
+		//     };
+		//
+		// Only the listed fields are written, so padding never reaches the wire, and fields may be strings,
+		// vectors or other reflected structs. The encoded size is known up front (at compile time when every
+		// field has a fixed size), so the body grows once and every field is copied in a single unrolled pass.
+
+		template <class Member>
+		struct member_type;
+
+		template <class Class, class Field>
+		struct member_type<Field Class::*> {
+			using type = Field;
+		};
+
+		template <class Member>
+		using member_type_t = typename member_type<Member>::type;
+
+		template <Reflected T>
+		constexpr std::size_t field_count_v = std::tuple_size_v<std::remove_cvref_t<decltype(T::fields)>>;
+
+		// calls f(&T::field) for every field, in wire order
+		template <Reflected T, class F>
+		constexpr void for_each_field(F&& f) {
+			std::apply([&](auto... members) { (f(members), ...); }, T::fields);
+		}
+
+		// calls f(&T::field) for every field, last to first
+		template <Reflected T, class F>
+		constexpr void for_each_field_reversed(F&& f) {
+			[&]<std::size_t... I>(std::index_sequence<I...>) {
+				(f(std::get<field_count_v<T> - 1 - I>(T::fields)), ...);
+			}(std::make_index_sequence<field_count_v<T>>{});
+		}
+
+		// Encoded size of a value, in the layout shared by MessageWriter and MessageBase::operator<<.
+		// is_fixed  - every value of the type encodes to fixed_size bytes
+		// of(value) - the exact encoded size of `value`
+		template <class DataType, class = void>
+		struct EncodedSize;
+
+		template <class DataType>
+		struct EncodedSize<DataType, std::enable_if_t<is_raw_serializable_v<DataType>>> {
+			static constexpr bool const is_fixed = true;
+			static constexpr std::size_t const fixed_size = sizeof(DataType);
+
+			static constexpr std::size_t of(DataType const&) {
+				return sizeof(DataType);
+			}
+		};
+
+		// arrays are their element count followed by the elements
+		template <class DataType>
+		struct EncodedArraySize {
+			static constexpr bool const is_fixed = false;
+			static constexpr std::size_t const fixed_size = sizeof(uint32_t);
+
+			template <class Range>
+			static constexpr std::size_t of(Range const& data) {
+				if constexpr (EncodedSize<DataType>::is_fixed) {
+					return sizeof(uint32_t) + std::size(data) * EncodedSize<DataType>::fixed_size;
+				}
+				else {
+					std::size_t size = sizeof(uint32_t);
+					for (DataType const& item : data) {
+						size += EncodedSize<DataType>::of(item);
+					}
+					return size;
+				}
+			}
+		};
+
+		template <class CharT, class Traits, class Alloc>
+		struct EncodedSize<std::basic_string<CharT, Traits, Alloc>> : EncodedArraySize<CharT> {};
+
+		template <class CharT, class Traits>
+		struct EncodedSize<std::basic_string_view<CharT, Traits>> : EncodedArraySize<CharT> {};
+
+		template <class DataType, class Alloc>
+		struct EncodedSize<std::vector<DataType, Alloc>> : EncodedArraySize<DataType> {};
+
+		template <class DataType, std::size_t Extent>
+		struct EncodedSize<std::span<DataType, Extent>> : EncodedArraySize<std::remove_const_t<DataType>> {};
+
+		template <Reflected DataType>
+		struct EncodedSize<DataType> {
+			static constexpr bool const is_fixed = std::apply([](auto... members) {
+				return (EncodedSize<member_type_t<decltype(members)>>::is_fixed && ...);
+			}, DataType::fields);
+
+			static constexpr std::size_t const fixed_size = std::apply([](auto... members) {
+				return (std::size_t(0) + ... + EncodedSize<member_type_t<decltype(members)>>::fixed_size);
+			}, DataType::fields);
+
+			static constexpr std::size_t of(DataType const& data) {
+				if constexpr (is_fixed) {
+					return fixed_size;
+				}
+				else {
+					std::size_t size = 0;
+					for_each_field<DataType>([&](auto member) {
+						size += EncodedSize<member_type_t<decltype(member)>>::of(data.*member);
+					});
+					return size;
+				}
+			}
+		};
+
+		template <class DataType>
+		constexpr std::size_t encoded_size(DataType const& data) {
+			return EncodedSize<DataType>::of(data);
+		}
+
+		// the exact encoded size of types whose every field has a fixed size
+		template <class DataType>
+		requires EncodedSize<DataType>::is_fixed
+		constexpr std::size_t fixed_encoded_size_v = EncodedSize<DataType>::fixed_size;
+
+		// Reflected struct implementation for MessageWriter/MessageReader
+		template <Reflected DataType>
+		struct StreamSerializeType<DataType> {
+			template <class Writer>
+			static void write(Writer& writer, DataType const& data) {
+				if constexpr (std::is_same_v<Writer, BufferWriter>) {
+					// a nested struct, the outermost one already made room for us
+					write_fields(writer, data);
+				}
+				else {
+					BufferWriter out(writer.append(encoded_size(data)));
+					write_fields(out, data);
+				}
+			}
+
+			static void read(MessageReader& reader, DataType& data) {
+				for_each_field<DataType>([&](auto member) {
+					reader >> data.*member;
+				});
+			}
+
+		private:
+			static void write_fields(BufferWriter& out, DataType const& data) {
+				for_each_field<DataType>([&](auto member) {
+					out << data.*member;
+				});
+			}
+		};
+
+#ifndef GAMECORE_NET_OVERRIDE_DEFAULT_SERIALIZER_IMPLEMENTATION
+
+		// Reflected struct serialization implementation for MessageBase::operator<< and operator>>.
+		// Fields are pushed in order and, since the body is a stack, popped last to first.
+		template <Reflected DataType, IMessageHeader H, class B>
+		struct SerializeType<DataType, MessageBase<H, B>> {
+			static void write(MessageBase<H, B>& msg, DataType const& data) {
+				msg.m_body.reserve(msg.m_body.size() + encoded_size(data));
+				for_each_field<DataType>([&](auto member) {
+					msg << data.*member;
+				});
+			}
+
+			static void read(MessageBase<H, B>& msg, DataType& data) {
+				for_each_field_reversed<DataType>([&](auto member) {
+					msg >> data.*member;
+				});
+			}
+		};
+
+#endif // !GAMECORE_NET_OVERRIDE_DEFAULT_SERIALIZER_IMPLEMENTATION
+	}
+}
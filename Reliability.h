@@ -0,0 +1,553 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <initializer_list>
+#include <memory>
+#include <span>
+#include <vector>
+#include <stdint.h>
+
+#include "./Connection.h"
+#include "./IMessage.h"
+#include "./MessageStream.h"
+#include "./Session.h"
+
+// reliable messages in flight per channel, and how far ahead of the next in-order message the receiver buffers.
+// must be a power of two
+#ifndef RELIABLE_WINDOW_SIZE
+#define RELIABLE_WINDOW_SIZE 256
+#endif
+
+// sent packets remembered for acks and rtt samples, must be a power of two
+#ifndef RELIABLE_SENT_PACKET_HISTORY
+#define RELIABLE_SENT_PACKET_HISTORY 1024
+#endif
+
+// retransmission timeout before there's an rtt sample, and its bounds afterwards
+#ifndef RELIABLE_INITIAL_RTO_MS
+#define RELIABLE_INITIAL_RTO_MS 200
+#endif
+
+#ifndef RELIABLE_MIN_RTO_MS
+#define RELIABLE_MIN_RTO_MS 30
+#endif
+
+#ifndef RELIABLE_MAX_RTO_MS
+#define RELIABLE_MAX_RTO_MS 2000
+#endif
+
+// how long received packets wait for outgoing traffic to carry their ack before a bare ack is sent
+#ifndef RELIABLE_ACK_DELAY_MS
+#define RELIABLE_ACK_DELAY_MS 20
+#endif
+
+
+namespace xpo {
+	namespace net {
+		enum class ChannelMode : uint8_t {
+			Unreliable,				// may be lost, duplicated or reordered
+			UnreliableSequenced,	// may be lost, anything older than the newest delivered is dropped
+			ReliableUnordered,		// delivered exactly once, in any order
+			ReliableOrdered,		// delivered exactly once, in the order it was sent
+		};
+
+		constexpr bool is_reliable(ChannelMode mode) {
+			return mode == ChannelMode::ReliableUnordered || mode == ChannelMode::ReliableOrdered;
+		}
+
+		// true if 16 bit sequence `a` is newer than `b`, allowing for wrap around
+		constexpr bool sequence_newer(uint16_t a, uint16_t b) {
+			return static_cast<int16_t>(a - b) > 0;
+		}
+
+		// Fixed size table indexed by a 16 bit sequence number, slot `sequence % N`.
+		// A slot only matches the sequence that was last inserted in it, so stale entries just stop being found.
+		template <class T, size_t N>
+		class SequenceBuffer {
+			static_assert(N > 0 && N <= 65536 && (N & (N - 1)) == 0, "N must be a power of two of at most 65536");
+
+		public:
+			SequenceBuffer()
+				: m_sequences(std::make_unique<uint32_t[]>(N))
+				, m_entries(std::make_unique<T[]>(N))
+			{
+				std::fill_n(m_sequences.get(), N, empty);
+			}
+
+			T* find(uint16_t sequence) {
+				size_t index = sequence % N;
+				return m_sequences[index] == sequence ? &m_entries[index] : nullptr;
+			}
+
+			T const* find(uint16_t sequence) const {
+				size_t index = sequence % N;
+				return m_sequences[index] == sequence ? &m_entries[index] : nullptr;
+			}
+
+			T& insert(uint16_t sequence) {
+				size_t index = sequence % N;
+				m_sequences[index] = sequence;
+				m_entries[index] = T();
+				return m_entries[index];
+			}
+
+			void remove(uint16_t sequence) {
+				size_t index = sequence % N;
+				if (m_sequences[index] == sequence) {
+					m_sequences[index] = empty;
+					m_entries[index] = T();
+				}
+			}
+
+		private:
+			static constexpr uint32_t const empty = UINT32_MAX;
+
+			std::unique_ptr<uint32_t[]> m_sequences;
+			std::unique_ptr<T[]> m_entries;
+		};
+
+		// Reliability for one remote peer, on top of any datagram path.
+		//
+		// Every message sent becomes a packet with its own sequence number, and every packet carries an ack of the
+		// newest packet received plus a bitfield of the 32 before it, so acks ride on regular traffic.
+		// Reliable messages stay queued until a packet carrying them is acked, and are re-sent in a new packet once
+		// the retransmission timeout, derived from measured rtt (RFC 6298 style), expires. Only the unacked ones go again.
+		// Because a retransmission is a new packet, rtt samples are never ambiguous.
+		//
+		// Wire prefix in front of the message body:
+		//   uint16 sequence, uint16 ack, uint32 ack bits, uint8 channel (top bit set when the ack is valid),
+		//   uint16 message id (every mode but Unreliable)
+		// Both peers must configure the same channels.
+		template <IByteMessage M>
+		class ReliableEndpoint {
+		public:
+			using clock = std::chrono::steady_clock;
+
+			static constexpr uint8_t const ack_only_channel = 0x7F;
+			static constexpr uint8_t const has_ack_flag = 0x80;
+
+			ReliableEndpoint(std::span<ChannelMode const> channels) {
+				for (ChannelMode mode : channels) {
+					m_channels.push_back(std::make_unique<Channel>(mode));
+				}
+			}
+
+			ReliableEndpoint(std::initializer_list<ChannelMode> channels)
+				: ReliableEndpoint(std::span<ChannelMode const>(channels.begin(), channels.size()))
+			{}
+
+			size_t channel_count() const {
+				return m_channels.size();
+			}
+
+			// wraps `msg` for `channel` and hands the packet to send(M&&).
+			// returns false if the channel's window of unacked reliable messages is full, nothing is sent then.
+			template <class Send>
+			bool send(uint8_t channel, M const& msg, clock::time_point now, Send&& send) {
+				Channel& ch = *m_channels[channel];
+				uint16_t id = ch.nextId;
+				if (is_reliable(ch.mode)) {
+					if (static_cast<uint16_t>(id - ch.oldestUnacked) >= RELIABLE_WINDOW_SIZE) {
+						return false;
+					}
+					Pending& pending = ch.pending.insert(id);
+					pending.message = msg;
+					pending.lastSent = now;
+				}
+				++ch.nextId;
+				send(wrap(channel, id, msg, now));
+				return true;
+			}
+
+			// unwraps a packet, processes the acks it carries and calls deliver(M&, uint8_t channel) for every message
+			// that's ready. returns false if the packet is malformed.
+			template <class Deliver>
+			bool receive(M& packet, clock::time_point now, Deliver&& deliver) {
+				MessageReader reader(packet.body());
+				uint16_t sequence = 0;
+				uint16_t ack = 0;
+				uint32_t ackBits = 0;
+				uint8_t flags = 0;
+				reader >> sequence >> ack >> ackBits >> flags;
+				uint8_t channel = flags & ~has_ack_flag;
+				if (!reader || (channel != ack_only_channel && channel >= m_channels.size())) {
+					return false;
+				}
+				uint16_t id = 0;
+				if (channel != ack_only_channel && m_channels[channel]->mode != ChannelMode::Unreliable) {
+					reader >> id;
+					if (!reader) {
+						return false;
+					}
+				}
+
+				// a bare ack is recorded so the peer's acks stay right, but doesn't need acking itself,
+				// otherwise two idle peers would keep acking each other's acks
+				record_received(sequence, channel != ack_only_channel);
+				if (flags & has_ack_flag) {
+					acknowledge(ack, now);
+					for (uint16_t i = 0; i < 32; ++i) {
+						if (ackBits & (1u << i)) {
+							acknowledge(static_cast<uint16_t>(ack - 1 - i), now);
+						}
+					}
+				}
+				if (channel == ack_only_channel) {
+					return true;
+				}
+
+				M msg;
+				msg.header = packet.header;
+				auto body = reader.remaining_bytes();
+				msg.resize(body.size());
+				if (!body.empty()) {
+					std::memcpy(msg.data(), body.data(), body.size());
+				}
+				msg.header.m_size = body.size();
+				dispatch(channel, id, msg, deliver);
+				return true;
+			}
+
+			// re-sends reliable messages whose timeout expired, and a bare ack if received packets have been waiting
+			// too long for outgoing traffic. call it regularly, e.g. once a tick.
+			template <class Send>
+			void update(clock::time_point now, Send&& send) {
+				bool expired = false;
+				for (size_t channel = 0; channel < m_channels.size(); ++channel) {
+					Channel& ch = *m_channels[channel];
+					if (!is_reliable(ch.mode)) {
+						continue;
+					}
+					for (uint16_t id = ch.oldestUnacked; id != ch.nextId; ++id) {
+						Pending* pending = ch.pending.find(id);
+						if (pending != nullptr && now - pending->lastSent >= m_rto) {
+							pending->lastSent = now;
+							send(wrap(static_cast<uint8_t>(channel), id, pending->message, now));
+							expired = true;
+						}
+					}
+				}
+				// back off while nothing gets through, like RFC 6298 5.5. the next rtt sample sets it again.
+				if (expired) {
+					m_rto = std::min<clock::duration>(m_rto * 2, std::chrono::milliseconds(RELIABLE_MAX_RTO_MS));
+				}
+
+				if (m_unackedReceived > 0 && (now - m_lastSend >= std::chrono::milliseconds(RELIABLE_ACK_DELAY_MS) || m_unackedReceived >= 16)) {
+					send(wrap(ack_only_channel, 0, M(), now));
+				}
+			}
+
+			clock::duration rtt() const {
+				return m_srtt;
+			}
+
+			clock::duration rto() const {
+				return m_rto;
+			}
+
+			// reliable messages on `channel` not acked yet
+			size_t unacked(uint8_t channel) const {
+				Channel const& ch = *m_channels[channel];
+				return is_reliable(ch.mode) ? static_cast<uint16_t>(ch.nextId - ch.oldestUnacked) : 0;
+			}
+
+			// reliable messages still waiting for an ack, on every channel
+			size_t in_flight() const {
+				size_t count = 0;
+				for (auto const& ch : m_channels) {
+					if (!is_reliable(ch->mode)) {
+						continue;
+					}
+					for (uint16_t id = ch->oldestUnacked; id != ch->nextId; ++id) {
+						if (ch->pending.find(id) != nullptr) {
+							++count;
+						}
+					}
+				}
+				return count;
+			}
+
+		private:
+			struct Pending {
+				M message;
+				clock::time_point lastSent;
+			};
+
+			struct SentPacket {
+				clock::time_point time;
+				uint8_t channel;
+				uint16_t messageId;
+				bool reliable;
+				bool acked;
+			};
+
+			struct Channel {
+				Channel(ChannelMode mode)
+					: mode(mode)
+				{}
+
+				ChannelMode mode;
+
+				// sending
+				uint16_t nextId = 0;
+				uint16_t oldestUnacked = 0;
+				SequenceBuffer<Pending, RELIABLE_WINDOW_SIZE> pending;
+
+				// receiving
+				bool hasReceived = false;
+				uint16_t newestReceived = 0;
+				uint16_t nextExpected = 0;
+				SequenceBuffer<bool, RELIABLE_WINDOW_SIZE> received;
+				SequenceBuffer<M, RELIABLE_WINDOW_SIZE> reorder;
+			};
+
+			M wrap(uint8_t channel, uint16_t id, M const& msg, clock::time_point now) {
+				uint16_t sequence = m_sequence++;
+				bool withId = channel != ack_only_channel && m_channels[channel]->mode != ChannelMode::Unreliable;
+				if (channel != ack_only_channel) {
+					m_sent.insert(sequence) = { now, channel, id, is_reliable(m_channels[channel]->mode), false };
+				}
+
+				auto body = msg.body();
+				size_t prefixSize = sizeof(uint16_t) * 2 + sizeof(uint32_t) + sizeof(uint8_t) + (withId ? sizeof(uint16_t) : 0);
+				M packet;
+				packet.header = msg.header;
+				packet.resize(prefixSize + body.size());
+				BufferWriter writer(packet.data());
+				writer << sequence << m_remoteSequence << m_receivedBits << static_cast<uint8_t>(channel | (m_hasReceived ? has_ack_flag : 0));
+				if (withId) {
+					writer << id;
+				}
+				writer.write_bytes(body.data(), body.size());
+				packet.header.m_size = prefixSize + body.size();
+
+				m_lastSend = now;
+				m_unackedReceived = 0;
+				return packet;
+			}
+
+			void record_received(uint16_t sequence, bool needsAck) {
+				if (needsAck) {
+					++m_unackedReceived;
+				}
+				if (!m_hasReceived) {
+					m_hasReceived = true;
+					m_remoteSequence = sequence;
+					m_receivedBits = 0;
+				}
+				else if (sequence_newer(sequence, m_remoteSequence)) {
+					uint16_t diff = sequence - m_remoteSequence;
+					// the previous newest becomes bit diff - 1
+					if (diff > 32) {
+						m_receivedBits = 0;
+					}
+					else if (diff == 32) {
+						m_receivedBits = 1u << 31;
+					}
+					else {
+						m_receivedBits = (m_receivedBits << diff) | (1u << (diff - 1));
+					}
+					m_remoteSequence = sequence;
+				}
+				else {
+					uint16_t diff = m_remoteSequence - sequence;
+					if (diff >= 1 && diff <= 32) {
+						m_receivedBits |= 1u << (diff - 1);
+					}
+				}
+			}
+
+			void acknowledge(uint16_t sequence, clock::time_point now) {
+				SentPacket* sent = m_sent.find(sequence);
+				if (sent == nullptr || sent->acked) {
+					return;
+				}
+				sent->acked = true;
+				update_rtt(now - sent->time);
+
+				if (sent->reliable) {
+					Channel& ch = *m_channels[sent->channel];
+					ch.pending.remove(sent->messageId);
+					while (ch.oldestUnacked != ch.nextId && ch.pending.find(ch.oldestUnacked) == nullptr) {
+						++ch.oldestUnacked;
+					}
+				}
+			}
+
+			void update_rtt(clock::duration sample) {
+				if (!m_hasRtt) {
+					m_srtt = sample;
+					m_rttVar = sample / 2;
+					m_hasRtt = true;
+				}
+				else {
+					clock::duration error = sample > m_srtt ? sample - m_srtt : m_srtt - sample;
+					m_rttVar = (m_rttVar * 3 + error) / 4;
+					m_srtt = (m_srtt * 7 + sample) / 8;
+				}
+				m_rto = std::clamp<clock::duration>(m_srtt + m_rttVar * 4, std::chrono::milliseconds(RELIABLE_MIN_RTO_MS), std::chrono::milliseconds(RELIABLE_MAX_RTO_MS));
+			}
+
+			template <class Deliver>
+			void dispatch(uint8_t channel, uint16_t id, M& msg, Deliver& deliver) {
+				Channel& ch = *m_channels[channel];
+				switch (ch.mode) {
+				case ChannelMode::Unreliable:
+					deliver(msg, channel);
+					break;
+
+				case ChannelMode::UnreliableSequenced:
+					if (!ch.hasReceived || sequence_newer(id, ch.newestReceived)) {
+						ch.hasReceived = true;
+						ch.newestReceived = id;
+						deliver(msg, channel);
+					}
+					break;
+
+				case ChannelMode::ReliableUnordered:
+					// anything older than the window was delivered already, the sender can't have it in flight anymore
+					if (ch.hasReceived && !sequence_newer(id, static_cast<uint16_t>(ch.newestReceived - RELIABLE_WINDOW_SIZE))) {
+						break;
+					}
+					if (ch.received.find(id) != nullptr) {
+						break;
+					}
+					ch.received.insert(id) = true;
+					if (!ch.hasReceived || sequence_newer(id, ch.newestReceived)) {
+						ch.hasReceived = true;
+						ch.newestReceived = id;
+					}
+					deliver(msg, channel);
+					break;
+
+				case ChannelMode::ReliableOrdered:
+					if (id == ch.nextExpected) {
+						deliver(msg, channel);
+						++ch.nextExpected;
+						// whatever arrived early and is now next in line
+						while (M* next = ch.reorder.find(ch.nextExpected)) {
+							deliver(*next, channel);
+							ch.reorder.remove(ch.nextExpected);
+							++ch.nextExpected;
+						}
+					}
+					else if (sequence_newer(id, ch.nextExpected) && static_cast<uint16_t>(id - ch.nextExpected) < RELIABLE_WINDOW_SIZE) {
+						if (ch.reorder.find(id) == nullptr) {
+							ch.reorder.insert(id) = std::move(msg);
+						}
+					}
+					break;
+				}
+			}
+
+			std::vector<std::unique_ptr<Channel>> m_channels;
+			SequenceBuffer<SentPacket, RELIABLE_SENT_PACKET_HISTORY> m_sent;
+
+			uint16_t m_sequence = 0;
+			bool m_hasReceived = false;
+			uint16_t m_remoteSequence = 0;
+			uint32_t m_receivedBits = 0;
+			uint32_t m_unackedReceived = 0;
+			clock::time_point m_lastSend;
+
+			bool m_hasRtt = false;
+			clock::duration m_srtt{};
+			clock::duration m_rttVar{};
+			clock::duration m_rto = std::chrono::milliseconds(RELIABLE_INITIAL_RTO_MS);
+		};
+
+		// UDPConnection where every message goes through a channel of a per-endpoint ReliableEndpoint.
+		// Override on_channel_receive() instead of on_receive(), and call update() regularly to drive retransmissions.
+		// Peers not heard from for idle_timeout() are forgotten there too, their messages still in flight fail with
+		// ErrorCode::PeerTimedOut.
+		template <IByteMessage T, std::derived_from<IAsyncByteIO> AsyncT = ASIOAsyncUDPSocket>
+		struct ReliableUDPConnection : public UDPConnection<T, AsyncT> {
+			using clock = std::chrono::steady_clock;
+
+			template <class... Args>
+			ReliableUDPConnection(std::initializer_list<ChannelMode> channels, Args&&... args)
+				: UDPConnection<T, AsyncT>(std::forward<Args>(args)...)
+				, m_channels(channels)
+			{}
+
+			// plain send_message_to() is hidden, a peer would take the body for a reliability prefix
+			void send_message_to(T const& msg, asio::ip::udp::endpoint const& endPoint, uint8_t channel) {
+				this->execute_async([this, msg, endPoint, channel]() {
+					auto now = clock::now();
+					// sending doesn't keep a peer alive, only hearing from it does
+					ReliableEndpoint<T>* peer = m_peers.find(endPoint);
+					if (peer == nullptr) {
+						peer = m_peers.find_or_insert(endPoint, now, std::span<ChannelMode const>(m_channels)).first;
+					}
+					if (peer == nullptr) {
+						this->on_send_fail(make_error_code(ErrorCode::SessionLimit));
+					}
+					else if (!peer->send(channel, msg, now, sender(endPoint))) {
+						this->on_send_fail(make_error_code(ErrorCode::ChannelFull));
+					}
+				});
+			}
+
+			std::chrono::milliseconds idle_timeout() const {
+				return m_idleTimeout;
+			}
+
+			void idle_timeout(std::chrono::milliseconds timeout) {
+				m_idleTimeout = timeout;
+			}
+
+			void update() {
+				this->execute_async([this]() {
+					auto now = clock::now();
+					m_peers.evict_idle(now, m_idleTimeout, [this](asio::ip::udp::endpoint const&, ReliableEndpoint<T>& peer) {
+						for (size_t i = peer.in_flight(); i > 0; --i) {
+							this->on_send_fail(make_error_code(ErrorCode::PeerTimedOut));
+						}
+					});
+					m_peers.for_each([this, now](asio::ip::udp::endpoint const& endPoint, ReliableEndpoint<T>& peer) {
+						peer.update(now, sender(endPoint));
+					});
+				});
+			}
+
+			// forget everything about a peer
+			void disconnect(asio::ip::udp::endpoint const& endPoint) {
+				this->execute_async([this, endPoint]() {
+					m_peers.remove(endPoint);
+				});
+			}
+
+			virtual void on_channel_receive(T& msg, uint8_t channel) {
+				NET_LOG_DEBUG("Received on channel ", static_cast<int>(channel), ": ", msg);
+			}
+
+		protected:
+			void on_receive(T& packet) override {
+				auto now = clock::now();
+				ReliableEndpoint<T>* peer = m_peers.find_or_insert(this->remote_endpoint(), now, std::span<ChannelMode const>(m_channels)).first;
+				if (peer == nullptr) {
+					this->receive_failed(make_error_code(ErrorCode::SessionLimit));
+					return;
+				}
+				bool ok = peer->receive(packet, now, [this](T& msg, uint8_t channel) {
+					on_channel_receive(msg, channel);
+				});
+				if (!ok) {
+					this->receive_failed(make_error_code(ErrorCode::InvalidHeader));
+				}
+			}
+
+			auto sender(asio::ip::udp::endpoint const& endPoint) {
+				return [this, endPoint](T&& packet) {
+					this->send_message_async(OwnedMessage<T>(std::move(packet), endPoint));
+				};
+			}
+
+			std::vector<ChannelMode> m_channels;
+			SessionTable<ReliableEndpoint<T>> m_peers;
+			std::chrono::milliseconds m_idleTimeout{ SESSION_DEFAULT_IDLE_TIMEOUT_MS };
+		};
+	}
+}
@@ -0,0 +1,266 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <stdint.h>
+
+#include "./Futex.h"
+#include "./IQueue.h"
+
+#ifndef RING_QUEUE_DEFAULT_CAPACITY
+#define RING_QUEUE_DEFAULT_CAPACITY 1024
+#endif
+
+#ifndef RING_QUEUE_CACHE_LINE_SIZE
+#define RING_QUEUE_CACHE_LINE_SIZE 64
+#endif
+
+
+namespace xpo {
+	namespace net {
+		// Parks one consumer until any of several queues gets an item, each of them notifies it (see
+		// MPSCRingQueue::share_signal()). ready() is the consumer's check of all those queues.
+		class ConsumerSignal {
+		public:
+			template <class Ready>
+			void wait(Ready&& ready) {
+				while (!ready()) {
+					uint32_t signal = m_signal.load(std::memory_order_acquire);
+					m_parked.store(1, std::memory_order_relaxed);
+					// pairs with the fence in notify(), like MPSCRingQueue::wait()
+					std::atomic_thread_fence(std::memory_order_seq_cst);
+					if (ready()) {
+						m_parked.store(0, std::memory_order_relaxed);
+						return;
+					}
+					futex_wait(m_signal, signal);
+					m_parked.store(0, std::memory_order_relaxed);
+				}
+			}
+
+			// returns false if ready() still fails after `timeout`
+			template <class Ready, class Rep, class Period>
+			bool wait_for(Ready&& ready, std::chrono::duration<Rep, Period> const& timeout) {
+				auto deadline = std::chrono::steady_clock::now() + timeout;
+				while (!ready()) {
+					auto now = std::chrono::steady_clock::now();
+					if (now >= deadline) {
+						return false;
+					}
+					uint32_t signal = m_signal.load(std::memory_order_acquire);
+					m_parked.store(1, std::memory_order_relaxed);
+					std::atomic_thread_fence(std::memory_order_seq_cst);
+					if (ready()) {
+						m_parked.store(0, std::memory_order_relaxed);
+						return true;
+					}
+					futex_wait_for(m_signal, signal, deadline - now);
+					m_parked.store(0, std::memory_order_relaxed);
+				}
+				return true;
+			}
+
+			// producers, after publishing an item
+			void notify() {
+				std::atomic_thread_fence(std::memory_order_seq_cst);
+				if (m_parked.load(std::memory_order_relaxed)) {
+					m_signal.fetch_add(1, std::memory_order_release);
+					futex_wake_one(m_signal);
+				}
+			}
+
+		private:
+			alignas(RING_QUEUE_CACHE_LINE_SIZE) std::atomic<uint32_t> m_parked{ 0 };
+			std::atomic<uint32_t> m_signal{ 0 };
+		};
+
+		// Bounded multi-producer/single-consumer queue.
+		// Any thread may push, but only one thread may call front(), pop_front(), drain_into(), clear() and wait().
+		// Every slot carries a sequence number, so producers only contend on the tail index
+		// and the consumer never takes a lock. The consumer parks on a futex only when the ring is empty.
+		template <class T, std::size_t Capacity = RING_QUEUE_DEFAULT_CAPACITY>
+		class MPSCRingQueue {
+			static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+			struct alignas(RING_QUEUE_CACHE_LINE_SIZE) Slot {
+				std::atomic<std::size_t> sequence;
+				T value;
+			};
+
+		public:
+			MPSCRingQueue()
+				: m_slots(new Slot[Capacity])
+			{
+				for (std::size_t i = 0; i < Capacity; ++i) {
+					m_slots[i].sequence.store(i, std::memory_order_relaxed);
+				}
+			}
+
+			MPSCRingQueue(MPSCRingQueue const&) = delete;
+			virtual ~MPSCRingQueue() = default;
+
+			static constexpr std::size_t capacity() {
+				return Capacity;
+			}
+
+			T const& front() {
+				return slot(m_head.load(std::memory_order_relaxed)).value;
+			}
+
+			// returns false if the ring is full
+			bool try_push_back(T const& item) {
+				return emplace(item);
+			}
+
+			bool try_push_back(T&& item) {
+				return emplace(std::move(item));
+			}
+
+			// yields until the consumer frees a slot
+			void push_back(T const& item) {
+				while (!emplace(item)) {
+					std::this_thread::yield();
+				}
+			}
+
+			void push_back(T&& item) {
+				while (!emplace(std::move(item))) {
+					std::this_thread::yield();
+				}
+			}
+
+			bool empty() {
+				std::size_t head = m_head.load(std::memory_order_relaxed);
+				return slot(head).sequence.load(std::memory_order_acquire) != head + 1;
+			}
+
+			// may count items that are claimed by a producer but not yet published
+			std::size_t size() {
+				return m_tail.load(std::memory_order_relaxed) - m_head.load(std::memory_order_relaxed);
+			}
+
+			void clear() {
+				while (!empty()) {
+					pop_front();
+				}
+			}
+
+			T pop_front() {
+				std::size_t head = m_head.load(std::memory_order_relaxed);
+				Slot& s = slot(head);
+				T t = std::move(s.value);
+				s.sequence.store(head + Capacity, std::memory_order_release);
+				m_head.store(head + 1, std::memory_order_relaxed);
+				return t;
+			}
+
+			template <class Container>
+			std::size_t drain_into(Container& out, std::size_t max = SIZE_MAX) {
+				std::size_t count = 0;
+				while (count < max && !empty()) {
+					out.push_back(pop_front());
+					++count;
+				}
+				return count;
+			}
+
+			void wait() {
+				while (empty()) {
+					uint32_t signal = m_signal.load(std::memory_order_acquire);
+					m_parked.store(1, std::memory_order_relaxed);
+					// pairs with the fence in wake_consumer(): either we see the new item, or the producer sees us parked
+					std::atomic_thread_fence(std::memory_order_seq_cst);
+					if (!empty()) {
+						m_parked.store(0, std::memory_order_relaxed);
+						return;
+					}
+					futex_wait(m_signal, signal);
+					m_parked.store(0, std::memory_order_relaxed);
+				}
+			}
+
+			// returns false if the ring is still empty after `timeout`
+			template <class Rep, class Period>
+			bool wait_for(std::chrono::duration<Rep, Period> const& timeout) {
+				auto deadline = std::chrono::steady_clock::now() + timeout;
+				while (empty()) {
+					auto now = std::chrono::steady_clock::now();
+					if (now >= deadline) {
+						return false;
+					}
+					uint32_t signal = m_signal.load(std::memory_order_acquire);
+					m_parked.store(1, std::memory_order_relaxed);
+					std::atomic_thread_fence(std::memory_order_seq_cst);
+					if (!empty()) {
+						m_parked.store(0, std::memory_order_relaxed);
+						return true;
+					}
+					futex_wait_for(m_signal, signal, deadline - now);
+					m_parked.store(0, std::memory_order_relaxed);
+				}
+				return true;
+			}
+
+			// pushes also notify `signal`, for a consumer waiting on several queues at once.
+			// set it before any producer starts.
+			void share_signal(ConsumerSignal& signal) {
+				m_shared = &signal;
+			}
+
+		protected:
+			Slot& slot(std::size_t position) {
+				return m_slots[position & (Capacity - 1)];
+			}
+
+			template <class U>
+			bool emplace(U&& item) {
+				std::size_t position = m_tail.load(std::memory_order_relaxed);
+				Slot* s;
+				while (true) {
+					s = &slot(position);
+					std::size_t sequence = s->sequence.load(std::memory_order_acquire);
+					std::intptr_t diff = static_cast<std::intptr_t>(sequence) - static_cast<std::intptr_t>(position);
+					if (diff == 0) {
+						if (m_tail.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+							break;
+						}
+					}
+					else if (diff < 0) {
+						// the consumer has not released this slot yet, the ring is full
+						return false;
+					}
+					else {
+						position = m_tail.load(std::memory_order_relaxed);
+					}
+				}
+
+				s->value = std::forward<U>(item);
+				s->sequence.store(position + 1, std::memory_order_release);
+				wake_consumer();
+				return true;
+			}
+
+			void wake_consumer() {
+				std::atomic_thread_fence(std::memory_order_seq_cst);
+				if (m_parked.load(std::memory_order_relaxed)) {
+					m_signal.fetch_add(1, std::memory_order_release);
+					futex_wake_one(m_signal);
+				}
+				if (m_shared != nullptr) {
+					m_shared->notify();
+				}
+			}
+
+		protected:
+			std::unique_ptr<Slot[]> m_slots;
+			ConsumerSignal* m_shared = nullptr;
+
+			alignas(RING_QUEUE_CACHE_LINE_SIZE) std::atomic<std::size_t> m_tail{ 0 };
+			alignas(RING_QUEUE_CACHE_LINE_SIZE) std::atomic<std::size_t> m_head{ 0 };
+			alignas(RING_QUEUE_CACHE_LINE_SIZE) std::atomic<uint32_t> m_parked{ 0 };
+			std::atomic<uint32_t> m_signal{ 0 };
+		};
+	}
+}
@@ -1,6 +1,18 @@
 #pragma once
 
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include <asio/ts/net.hpp>
+
+#include "./ASIOSocket.h"
 #include "./IConnection.h"
+#include "./IQueue.h"
+#include "./RingQueue.h"
 
 
 namespace xpo {
@@ -13,5 +25,135 @@ namespace xpo {
 		protected:
 			T m_connection;
 		};
+
+#if defined(SO_REUSEPORT)
+		using reuse_port = asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>;
+#endif
+
+		// UDP server spread over K shards, each one a SO_REUSEPORT socket on the same port with its own
+		// io_context thread, connection and incoming queue. The kernel hashes a client's flow to one shard,
+		// so shards never share state, and update() drains every shard's queue on the game loop without a global lock.
+		// With an MPSCRingQueue as Q every queue also notifies one shared signal, so the game loop can wait() on all shards at once.
+		// Without SO_REUSEPORT (Windows) there is only ever one shard.
+		//
+		// C must be constructible from (ASIO_UDP&, Q&) and push what it receives into the queue.
+		template <class C, class Q, class M = std::remove_cvref_t<decltype(std::declval<Q&>().pop_front())>>
+		requires std::constructible_from<C, ASIO_UDP&, Q&> && IQueue<Q, M>
+		struct ShardedUDPServer {
+			using connection_type = C;
+			using queue_type = Q;
+			using message_type = M;
+
+			explicit ShardedUDPServer(size_t shards = std::thread::hardware_concurrency())
+#if defined(SO_REUSEPORT)
+				: m_shardCount(std::max<size_t>(shards, 1))
+#else
+				: m_shardCount(1)
+#endif
+			{}
+
+			virtual ~ShardedUDPServer() {
+				stop();
+			}
+
+			void start(uint16_t port) {
+				for (size_t i = 0; i < m_shardCount; ++i) {
+					auto shard = std::make_unique<Shard>();
+					shard->socket.open(asio::ip::udp::v4());
+#if defined(SO_REUSEPORT)
+					shard->socket.set_option(reuse_port(true));
+#endif
+					shard->socket.bind(asio::ip::udp::endpoint(asio::ip::udp::v4(), port));
+					if constexpr (requires { shard->incoming.share_signal(m_signal); }) {
+						shard->incoming.share_signal(m_signal);
+					}
+					shard->connection = std::make_unique<C>(shard->socket, shard->incoming);
+					shard->connection->listen_for_messages();
+					m_shards.push_back(std::move(shard));
+				}
+				// only start running once every socket is bound, so the kernel spreads flows over all of them
+				for (auto& shard : m_shards) {
+					shard->thread = std::thread([&context = shard->context]() {
+						context.run();
+					});
+				}
+			}
+
+			void stop() {
+				for (auto& shard : m_shards) {
+					shard->context.stop();
+				}
+				for (auto& shard : m_shards) {
+					if (shard->thread.joinable()) {
+						shard->thread.join();
+					}
+				}
+				m_shards.clear();
+			}
+
+			// hands every message received since the last update to on_message, shard by shard.
+			// returns how many there were.
+			size_t update() {
+				size_t count = 0;
+				for (auto& shard : m_shards) {
+					m_batch.clear();
+					shard->incoming.drain_into(m_batch, SIZE_MAX);
+					for (auto& msg : m_batch) {
+						on_message(*shard->connection, msg);
+					}
+					count += m_batch.size();
+				}
+				m_batch.clear();
+				return count;
+			}
+
+			// blocks until some shard has a message for update()
+			void wait() requires requires (Q& q, ConsumerSignal& signal) { q.share_signal(signal); } {
+				m_signal.wait([this]() { return has_messages(); });
+			}
+
+			// returns false if no shard got a message within `timeout`
+			template <class Rep, class Period>
+			bool wait_for(std::chrono::duration<Rep, Period> const& timeout) requires requires (Q& q, ConsumerSignal& signal) { q.share_signal(signal); } {
+				return m_signal.wait_for([this]() { return has_messages(); }, timeout);
+			}
+
+			size_t shard_count() const {
+				return m_shardCount;
+			}
+
+			C& connection(size_t shard) {
+				return *m_shards[shard]->connection;
+			}
+
+			Q& incoming(size_t shard) {
+				return m_shards[shard]->incoming;
+			}
+
+		protected:
+			// `connection` is the shard the message came in on, replying through it keeps the client on its shard
+			virtual void on_message(C& connection, M& msg) {}
+
+		private:
+			bool has_messages() {
+				return std::any_of(m_shards.begin(), m_shards.end(), [](auto& shard) {
+					return !shard->incoming.empty();
+				});
+			}
+
+			struct Shard {
+				asio::io_context context;
+				ASIO_UDP socket{ context };
+				Q incoming;
+				std::unique_ptr<C> connection;
+				std::thread thread;
+			};
+
+			size_t m_shardCount;
+			std::vector<std::unique_ptr<Shard>> m_shards;
+			std::vector<M> m_batch;
+			// every shard's queue notifies it, so wait() can sleep on all of them
+			ConsumerSignal m_signal;
+		};
 	}
 }
@@ -0,0 +1,322 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <utility>
+#include <vector>
+#include <stdint.h>
+
+#include "./Connection.h"
+#include "./Errors.h"
+#include "./IMessage.h"
+#include "./Metrics.h"
+
+// sessions a table holds at most, it never grows past this
+#ifndef SESSION_TABLE_DEFAULT_CAPACITY
+#define SESSION_TABLE_DEFAULT_CAPACITY 1024
+#endif
+
+// sessions that haven't been heard from for this long are dropped by update()
+#ifndef SESSION_DEFAULT_IDLE_TIMEOUT_MS
+#define SESSION_DEFAULT_IDLE_TIMEOUT_MS 10000
+#endif
+
+
+namespace xpo {
+	namespace net {
+		// Fixed capacity map from endpoint to per-session state S.
+		// Sessions live in a slab allocated up front, so pointers to a session's state stay valid until it is removed.
+		// The index over it is open addressing with linear probing, kept at most half full, and removal shifts
+		// entries back instead of leaving tombstones, so lookups stay short no matter how much churn there is.
+		// Nothing is allocated after construction, other than what S itself allocates when it's made.
+		// Not thread safe, a table belongs to one thread, usually a connection's io thread.
+		template <class S, class Key = asio::ip::udp::endpoint, class Hash = UDPEndpointHash>
+		class SessionTable {
+		public:
+			using clock = std::chrono::steady_clock;
+			using state_type = S;
+			using key_type = Key;
+
+			explicit SessionTable(size_t capacity = SESSION_TABLE_DEFAULT_CAPACITY)
+				: m_capacity(std::max<size_t>(capacity, 1))
+				, m_mask(std::bit_ceil(m_capacity * 2) - 1)
+				, m_index(std::make_unique<uint32_t[]>(m_mask + 1))
+				, m_sessions(std::make_unique<Session[]>(m_capacity))
+				, m_free(std::make_unique<uint32_t[]>(m_capacity))
+			{
+				std::fill_n(m_index.get(), m_mask + 1, empty);
+				for (size_t i = 0; i < m_capacity; ++i) {
+					// hand out the lowest slots first
+					m_free[i] = static_cast<uint32_t>(m_capacity - 1 - i);
+				}
+				m_freeCount = m_capacity;
+			}
+
+			S* find(Key const& key) {
+				size_t position = find_position(key, Hash()(key));
+				return position == npos ? nullptr : &*m_sessions[m_index[position]].state;
+			}
+
+			// the session for `key`, made from `args` if there isn't one. either way it counts as active at `now`.
+			// the bool is true if the session is new. returns a nullptr if it's new and the table is full.
+			template <class... Args>
+			std::pair<S*, bool> find_or_insert(Key const& key, clock::time_point now, Args&&... args) {
+				size_t hash = Hash()(key);
+				size_t position = hash & m_mask;
+				while (m_index[position] != empty) {
+					Session& session = m_sessions[m_index[position]];
+					if (session.hash == hash && session.key == key) {
+						session.lastSeen = now;
+						return { &*session.state, false };
+					}
+					position = (position + 1) & m_mask;
+				}
+
+				if (m_freeCount == 0) {
+					return { nullptr, false };
+				}
+				uint32_t slot = m_free[--m_freeCount];
+				Session& session = m_sessions[slot];
+				session.key = key;
+				session.hash = hash;
+				session.lastSeen = now;
+				session.state.emplace(std::forward<Args>(args)...);
+				m_index[position] = slot;
+				return { &*session.state, true };
+			}
+
+			// calls onRemove(Key const&, S&) before the session goes away, returns false if there was none
+			template <class OnRemove>
+			bool remove(Key const& key, OnRemove&& onRemove) {
+				size_t position = find_position(key, Hash()(key));
+				if (position == npos) {
+					return false;
+				}
+				Session& session = m_sessions[m_index[position]];
+				onRemove(session.key, *session.state);
+				erase(position);
+				return true;
+			}
+
+			bool remove(Key const& key) {
+				return remove(key, [](Key const&, S&) {});
+			}
+
+			// removes every session not seen for `timeout`, calling onRemove(Key const&, S&) for each. returns how many.
+			template <class OnRemove>
+			size_t evict_idle(clock::time_point now, clock::duration timeout, OnRemove&& onRemove) {
+				size_t count = 0;
+				for (size_t i = 0; i < m_capacity; ++i) {
+					Session& session = m_sessions[i];
+					if (session.state && now - session.lastSeen >= timeout) {
+						onRemove(session.key, *session.state);
+						erase(find_position(session.key, session.hash));
+						++count;
+					}
+				}
+				return count;
+			}
+
+			// calls f(Key const&, S&) for every session
+			template <class F>
+			void for_each(F&& f) {
+				for (size_t i = 0; i < m_capacity; ++i) {
+					Session& session = m_sessions[i];
+					if (session.state) {
+						f(session.key, *session.state);
+					}
+				}
+			}
+
+			size_t size() const {
+				return m_capacity - m_freeCount;
+			}
+
+			size_t capacity() const {
+				return m_capacity;
+			}
+
+			bool full() const {
+				return m_freeCount == 0;
+			}
+
+		private:
+			static constexpr uint32_t const empty = UINT32_MAX;
+			static constexpr size_t const npos = SIZE_MAX;
+
+			struct Session {
+				Key key{};
+				size_t hash = 0;
+				clock::time_point lastSeen;
+				std::optional<S> state;
+			};
+
+			size_t find_position(Key const& key, size_t hash) const {
+				size_t position = hash & m_mask;
+				while (m_index[position] != empty) {
+					Session const& session = m_sessions[m_index[position]];
+					if (session.hash == hash && session.key == key) {
+						return position;
+					}
+					position = (position + 1) & m_mask;
+				}
+				return npos;
+			}
+
+			// frees the session at index `position` and shifts the entries after it back, so every probe chain stays unbroken
+			void erase(size_t position) {
+				uint32_t slot = m_index[position];
+				m_sessions[slot].state.reset();
+				m_free[m_freeCount++] = slot;
+
+				size_t hole = position;
+				size_t next = (position + 1) & m_mask;
+				while (m_index[next] != empty) {
+					size_t home = m_sessions[m_index[next]].hash & m_mask;
+					// an entry can fill the hole if the hole isn't before where it belongs
+					if (((next - home) & m_mask) >= ((next - hole) & m_mask)) {
+						m_index[hole] = m_index[next];
+						hole = next;
+					}
+					next = (next + 1) & m_mask;
+				}
+				m_index[hole] = empty;
+			}
+
+			size_t m_capacity;
+			size_t m_mask;
+			std::unique_ptr<uint32_t[]> m_index;
+			std::unique_ptr<Session[]> m_sessions;
+			std::unique_ptr<uint32_t[]> m_free;
+			size_t m_freeCount = 0;
+		};
+
+		// UDPConnection that keeps a session of state S for every endpoint it hears from.
+		// The session is found with one table lookup per message and handed to on_session_receive().
+		// Call update() regularly, sessions idle for longer than idle_timeout() are dropped there,
+		// and every session's traffic is published for session_metrics().
+		template <IByteMessage T, class S, std::derived_from<IAsyncByteIO> AsyncT = ASIOAsyncUDPSocket>
+		struct SessionUDPConnection : public UDPConnection<T, AsyncT> {
+			using clock = std::chrono::steady_clock;
+			using session_type = S;
+
+			struct SessionMetricsSnapshot {
+				asio::ip::udp::endpoint endpoint;
+				SessionMetrics metrics;
+			};
+
+			using UDPConnection<T, AsyncT>::UDPConnection;
+
+			std::chrono::milliseconds idle_timeout() const {
+				return m_idleTimeout;
+			}
+
+			void idle_timeout(std::chrono::milliseconds timeout) {
+				m_idleTimeout = timeout;
+			}
+
+			void update() {
+				this->execute_async([this]() {
+					m_sessions.evict_idle(clock::now(), m_idleTimeout, [this](asio::ip::udp::endpoint const& endPoint, Entry& entry) {
+						on_disconnect(endPoint, entry.state);
+					});
+					publish_session_count();
+					publish_session_metrics();
+				});
+			}
+
+			void disconnect(asio::ip::udp::endpoint const& endPoint) {
+				this->execute_async([this, endPoint]() {
+					m_sessions.remove(endPoint, [this](asio::ip::udp::endpoint const& endPoint, Entry& entry) {
+						on_disconnect(endPoint, entry.state);
+					});
+					publish_session_count();
+				});
+			}
+
+			// every session's traffic as of the last update(), safe to call from any thread
+			std::vector<SessionMetricsSnapshot> session_metrics() const {
+				std::lock_guard<std::mutex> lock(m_metricsMutex);
+				return m_sessionMetrics;
+			}
+
+			// safe to call from any thread
+			size_t session_count() const {
+				return m_sessionCount.load(std::memory_order_relaxed);
+			}
+
+		protected:
+			// a message from an endpoint without a session, return false to refuse it.
+			// a refused endpoint gets asked again with its next message.
+			virtual bool on_connect(asio::ip::udp::endpoint const& endPoint, S& session) {
+				return true;
+			}
+
+			// the session was idle for too long or disconnect() was called
+			virtual void on_disconnect(asio::ip::udp::endpoint const& endPoint, S& session) {}
+
+			virtual void on_session_receive(S& session, T& msg) {
+				NET_LOG_DEBUG("Received from ", this->remote_endpoint(), ": ", msg);
+			}
+
+			void on_receive(T& msg) override {
+				auto const& endPoint = this->remote_endpoint();
+				auto [entry, isNew] = m_sessions.find_or_insert(endPoint, clock::now());
+				if (entry == nullptr) {
+					this->receive_failed(make_error_code(ErrorCode::SessionLimit));
+					return;
+				}
+				if (isNew) {
+					if (!on_connect(endPoint, entry->state)) {
+						m_sessions.remove(endPoint);
+						return;
+					}
+					publish_session_count();
+				}
+				entry->metrics.packetsIn += 1;
+				entry->metrics.bytesIn += msg.header.size();
+				on_session_receive(entry->state, msg);
+			}
+
+			void message_sent(OwnedMessage<T> const& msg) override {
+				if (Entry* entry = m_sessions.find(msg.endpoint())) {
+					entry->metrics.packetsOut += 1;
+					entry->metrics.bytesOut += msg.header.size();
+				}
+			}
+
+			void publish_session_count() {
+				m_sessionCount.store(m_sessions.size(), std::memory_order_relaxed);
+			}
+
+			void publish_session_metrics() {
+				m_publishing.clear();
+				m_sessions.for_each([this](asio::ip::udp::endpoint const& endPoint, Entry& entry) {
+					m_publishing.push_back({ endPoint, entry.metrics });
+				});
+				std::lock_guard<std::mutex> lock(m_metricsMutex);
+				m_sessionMetrics.swap(m_publishing);
+			}
+
+			// the session's state and what the io thread counted for it
+			struct Entry {
+				S state;
+				SessionMetrics metrics;
+			};
+
+			SessionTable<Entry> m_sessions;
+			std::chrono::milliseconds m_idleTimeout{ SESSION_DEFAULT_IDLE_TIMEOUT_MS };
+			// m_sessions.size() for other threads, the table itself is the io thread's
+			std::atomic<size_t> m_sessionCount = 0;
+
+			mutable std::mutex m_metricsMutex;
+			std::vector<SessionMetricsSnapshot> m_sessionMetrics;
+			std::vector<SessionMetricsSnapshot> m_publishing;
+		};
+	}
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <memory>
+#include <span>
+#include <stdint.h>
+
+#include "./HeaderCodec.h"
+#include "./IMessage.h"
+
+
+namespace xpo {
+	namespace net {
+		// Reference counted, immutable, pre-encoded message.
+		// The header is encoded once when the handle is made, every copy of the handle
+		// shares the same header bytes and body, so a broadcast to N endpoints costs
+		// one serialization and one payload no matter how many endpoints there are.
+		template <IByteMessage T>
+		struct SharedMessage {
+			using message_type = T;
+			using header_type = typename T::header_type;
+			using header_codec = HeaderCodec<header_type>;
+
+			SharedMessage() = default;
+
+			explicit SharedMessage(T const& msg)
+				: m_payload(std::make_shared<Payload>(T(msg)))
+			{}
+
+			explicit SharedMessage(T&& msg)
+				: m_payload(std::make_shared<Payload>(std::move(msg)))
+			{}
+
+			explicit operator bool() const {
+				return m_payload != nullptr;
+			}
+
+			header_type const& header() const {
+				return m_payload->message.header;
+			}
+
+			// empty if the codec could not encode the header
+			std::span<uint8_t const> header_bytes() const {
+				return { m_payload->headerBytes, m_payload->headerSize };
+			}
+
+			std::span<uint8_t const> body() const {
+				return { m_payload->message.data(), m_payload->message.header.size() };
+			}
+
+			size_t use_count() const {
+				return m_payload.use_count();
+			}
+
+		private:
+			struct Payload {
+				Payload(T&& msg)
+					: message(std::move(msg))
+					, headerSize(header_codec::encode(message.header, headerBytes))
+				{}
+
+				T message;
+				size_t headerSize;
+				uint8_t headerBytes[header_codec::max_size];
+			};
+
+			// never handed out as non-const, the message can't change once it is shared
+			std::shared_ptr<Payload> m_payload;
+		};
+	}
+}
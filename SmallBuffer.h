@@ -0,0 +1,182 @@
+#pragma once
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <utility>
+#include <stdint.h>
+
+#ifndef SMALL_MESSAGE_INLINE_SIZE
+#define SMALL_MESSAGE_INLINE_SIZE 64
+#endif
+
+
+namespace xpo {
+	namespace net {
+		// Byte container with room for N bytes inside the object itself.
+		// It only touches the allocator once it grows past N, so copying a small message is a plain memcpy.
+		// Has the part of the std::vector interface message bodies use. Unlike std::vector, resize()
+		// leaves new bytes uninitialized, since every caller overwrites them right away.
+		template <std::size_t N, class Alloc = std::allocator<uint8_t>>
+		class SmallBuffer {
+			using alloc_traits = std::allocator_traits<Alloc>;
+
+		public:
+			using value_type = uint8_t;
+			using size_type = std::size_t;
+			using iterator = uint8_t*;
+			using const_iterator = uint8_t const*;
+
+			SmallBuffer() noexcept = default;
+
+			SmallBuffer(SmallBuffer const& other)
+				: m_alloc(alloc_traits::select_on_container_copy_construction(other.m_alloc))
+			{
+				assign(other);
+			}
+
+			SmallBuffer(SmallBuffer&& other) noexcept
+				: m_alloc(std::move(other.m_alloc))
+			{
+				steal(other);
+			}
+
+			~SmallBuffer() {
+				release();
+			}
+
+			SmallBuffer& operator = (SmallBuffer const& other) {
+				if (this != &other) {
+					assign(other);
+				}
+				return *this;
+			}
+
+			SmallBuffer& operator = (SmallBuffer&& other) noexcept {
+				if (this != &other) {
+					release();
+					steal(other);
+				}
+				return *this;
+			}
+
+			uint8_t* data() noexcept {
+				return m_data;
+			}
+
+			uint8_t const* data() const noexcept {
+				return m_data;
+			}
+
+			std::size_t size() const noexcept {
+				return m_size;
+			}
+
+			std::size_t capacity() const noexcept {
+				return m_capacity;
+			}
+
+			bool empty() const noexcept {
+				return m_size == 0;
+			}
+
+			// true while the bytes live inside the object
+			bool is_inline() const noexcept {
+				return m_data == m_inline;
+			}
+
+			uint8_t* begin() noexcept {
+				return m_data;
+			}
+
+			uint8_t* end() noexcept {
+				return m_data + m_size;
+			}
+
+			uint8_t const* begin() const noexcept {
+				return m_data;
+			}
+
+			uint8_t const* end() const noexcept {
+				return m_data + m_size;
+			}
+
+			uint8_t& operator [] (std::size_t i) noexcept {
+				return m_data[i];
+			}
+
+			uint8_t const& operator [] (std::size_t i) const noexcept {
+				return m_data[i];
+			}
+
+			void reserve(std::size_t capacity) {
+				if (capacity > m_capacity) {
+					grow(capacity);
+				}
+			}
+
+			void resize(std::size_t size) {
+				if (size > m_capacity) {
+					grow(std::max(size, m_capacity * 2));
+				}
+				m_size = size;
+			}
+
+			// keeps the capacity, like std::vector
+			void clear() noexcept {
+				m_size = 0;
+			}
+
+		private:
+			void grow(std::size_t capacity) {
+				uint8_t* data = alloc_traits::allocate(m_alloc, capacity);
+				if (m_size > 0) {
+					std::memcpy(data, m_data, m_size);
+				}
+				release();
+				m_data = data;
+				m_capacity = capacity;
+			}
+
+			void release() noexcept {
+				if (!is_inline()) {
+					alloc_traits::deallocate(m_alloc, m_data, m_capacity);
+					m_data = m_inline;
+					m_capacity = N;
+				}
+			}
+
+			void assign(SmallBuffer const& other) {
+				m_size = 0;
+				reserve(other.m_size);
+				if (other.m_size > 0) {
+					std::memcpy(m_data, other.m_data, other.m_size);
+				}
+				m_size = other.m_size;
+			}
+
+			void steal(SmallBuffer& other) noexcept {
+				if (other.is_inline()) {
+					std::memcpy(m_inline, other.m_inline, other.m_size);
+					m_data = m_inline;
+					m_capacity = N;
+				}
+				else {
+					m_data = other.m_data;
+					m_capacity = other.m_capacity;
+					other.m_data = other.m_inline;
+					other.m_capacity = N;
+				}
+				m_size = other.m_size;
+				other.m_size = 0;
+			}
+
+		private:
+			[[no_unique_address]] Alloc m_alloc{};
+			uint8_t* m_data = m_inline;
+			std::size_t m_size = 0;
+			std::size_t m_capacity = N;
+			uint8_t m_inline[N];
+		};
+	}
+}
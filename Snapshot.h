@@ -0,0 +1,321 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <concepts>
+#include <cstring>
+#include <vector>
+#include <stdint.h>
+
+#include "./MessageStream.h"
+#include "./Reflection.h"
+
+#ifndef SNAPSHOT_DEFAULT_HISTORY
+#define SNAPSHOT_DEFAULT_HISTORY 32
+#endif
+
+
+namespace xpo {
+	namespace net {
+		// Field level delta encoding.
+		//
+		// DeltaCodec<T>::write() encodes `current` against `baseline` and read() rebuilds it from the same baseline.
+		// Reflected structs send a bitmask of the fields that changed followed by the delta of each changed field,
+		// vectors and arrays do the same per element, and everything else is sent whole (through MessageWriter) when it changed.
+		template <class DataType, class = void>
+		struct DeltaCodec {
+			static bool equal(DataType const& a, DataType const& b) {
+				if constexpr (std::equality_comparable<DataType>) {
+					return a == b;
+				}
+				else {
+					static_assert(std::is_trivially_copyable_v<DataType>, "Delta encoded values must be comparable");
+					return std::memcmp(&a, &b, sizeof(DataType)) == 0;
+				}
+			}
+
+			template <class Writer>
+			static void write(Writer& writer, DataType const& baseline, DataType const& current) {
+				writer << current;
+			}
+
+			static void read(MessageReader& reader, DataType const& baseline, DataType& current) {
+				reader >> current;
+			}
+		};
+
+		// writes one bit per element of `count`, set where `changed(i)` is true
+		template <class Writer, class F>
+		void write_change_mask(Writer& writer, size_t count, F&& changed) {
+			for (size_t i = 0; i < count; i += 8) {
+				uint8_t bits = 0;
+				for (size_t b = 0; b < 8 && i + b < count; ++b) {
+					if (changed(i + b)) {
+						bits |= uint8_t(1) << b;
+					}
+				}
+				writer << bits;
+			}
+		}
+
+		// returns a view of the mask written by write_change_mask()
+		inline std::span<const uint8_t> read_change_mask(MessageReader& reader, size_t count) {
+			return reader.read_bytes((count + 7) / 8);
+		}
+
+		inline bool is_changed(std::span<const uint8_t> mask, size_t i) {
+			return (mask[i / 8] >> (i % 8)) & 1;
+		}
+
+		// Reflected struct implementation, one bit per field
+		template <Reflected DataType>
+		struct DeltaCodec<DataType> {
+			static bool equal(DataType const& a, DataType const& b) {
+				bool same = true;
+				for_each_field<DataType>([&](auto member) {
+					same = same && DeltaCodec<member_type_t<decltype(member)>>::equal(a.*member, b.*member);
+				});
+				return same;
+			}
+
+			template <class Writer>
+			static void write(Writer& writer, DataType const& baseline, DataType const& current) {
+				std::array<bool, field_count_v<DataType>> changed{};
+				size_t i = 0;
+				for_each_field<DataType>([&](auto member) {
+					changed[i++] = !DeltaCodec<member_type_t<decltype(member)>>::equal(baseline.*member, current.*member);
+				});
+				write_change_mask(writer, changed.size(), [&](size_t field) { return changed[field]; });
+
+				i = 0;
+				for_each_field<DataType>([&](auto member) {
+					if (changed[i++]) {
+						DeltaCodec<member_type_t<decltype(member)>>::write(writer, baseline.*member, current.*member);
+					}
+				});
+			}
+
+			static void read(MessageReader& reader, DataType const& baseline, DataType& current) {
+				std::span<const uint8_t> mask = read_change_mask(reader, field_count_v<DataType>);
+				size_t i = 0;
+				for_each_field<DataType>([&](auto member) {
+					if (reader && is_changed(mask, i)) {
+						DeltaCodec<member_type_t<decltype(member)>>::read(reader, baseline.*member, current.*member);
+					}
+					else {
+						current.*member = baseline.*member;
+					}
+					++i;
+				});
+			}
+		};
+
+		// Fixed size array implementation, one bit per element
+		template <class DataType, std::size_t N>
+		struct DeltaCodec<std::array<DataType, N>> {
+			static bool equal(std::array<DataType, N> const& a, std::array<DataType, N> const& b) {
+				for (size_t i = 0; i < N; ++i) {
+					if (!DeltaCodec<DataType>::equal(a[i], b[i])) {
+						return false;
+					}
+				}
+				return true;
+			}
+
+			template <class Writer>
+			static void write(Writer& writer, std::array<DataType, N> const& baseline, std::array<DataType, N> const& current) {
+				std::array<bool, N> changed;
+				for (size_t i = 0; i < N; ++i) {
+					changed[i] = !DeltaCodec<DataType>::equal(baseline[i], current[i]);
+				}
+				write_change_mask(writer, N, [&](size_t i) { return changed[i]; });
+				for (size_t i = 0; i < N; ++i) {
+					if (changed[i]) {
+						DeltaCodec<DataType>::write(writer, baseline[i], current[i]);
+					}
+				}
+			}
+
+			static void read(MessageReader& reader, std::array<DataType, N> const& baseline, std::array<DataType, N>& current) {
+				std::span<const uint8_t> mask = read_change_mask(reader, N);
+				for (size_t i = 0; i < N; ++i) {
+					if (reader && is_changed(mask, i)) {
+						DeltaCodec<DataType>::read(reader, baseline[i], current[i]);
+					}
+					else {
+						current[i] = baseline[i];
+					}
+				}
+			}
+		};
+
+		// Vector implementation: the new size, one bit per element that also exists in the baseline,
+		// the deltas of the changed ones and then every element past the end of the baseline in full
+		template <class DataType, class Alloc>
+		struct DeltaCodec<std::vector<DataType, Alloc>> {
+			static bool equal(std::vector<DataType, Alloc> const& a, std::vector<DataType, Alloc> const& b) {
+				return a.size() == b.size() && std::equal(a.begin(), a.end(), b.begin(), DeltaCodec<DataType>::equal);
+			}
+
+			template <class Writer>
+			static void write(Writer& writer, std::vector<DataType, Alloc> const& baseline, std::vector<DataType, Alloc> const& current) {
+				uint32_t count = static_cast<uint32_t>(current.size());
+				size_t common = std::min(current.size(), baseline.size());
+				writer << count;
+				write_change_mask(writer, common, [&](size_t i) { return !DeltaCodec<DataType>::equal(baseline[i], current[i]); });
+				for (size_t i = 0; i < common; ++i) {
+					if (!DeltaCodec<DataType>::equal(baseline[i], current[i])) {
+						DeltaCodec<DataType>::write(writer, baseline[i], current[i]);
+					}
+				}
+				for (size_t i = common; i < current.size(); ++i) {
+					writer << current[i];
+				}
+			}
+
+			static void read(MessageReader& reader, std::vector<DataType, Alloc> const& baseline, std::vector<DataType, Alloc>& current) {
+				uint32_t count = 0;
+				reader >> count;
+				// new elements take at least a byte each
+				if (count > baseline.size() + reader.remaining()) {
+					reader.fail();
+					return;
+				}
+				size_t common = std::min<size_t>(count, baseline.size());
+				std::span<const uint8_t> mask = read_change_mask(reader, common);
+				current.resize(count);
+				for (size_t i = 0; i < common; ++i) {
+					if (reader && is_changed(mask, i)) {
+						DeltaCodec<DataType>::read(reader, baseline[i], current[i]);
+					}
+					else {
+						current[i] = baseline[i];
+					}
+				}
+				for (size_t i = common; i < count && reader; ++i) {
+					reader >> current[i];
+				}
+			}
+		};
+
+		// A bounded ring of snapshots, indexed by sequence number
+		template <class State, std::size_t Capacity>
+		class SnapshotRing {
+		public:
+			State const* find(uint32_t sequence) const {
+				Entry const& entry = m_entries[sequence % Capacity];
+				return entry.valid && entry.sequence == sequence ? &entry.state : nullptr;
+			}
+
+			void store(uint32_t sequence, State const& state) {
+				Entry& entry = m_entries[sequence % Capacity];
+				entry.sequence = sequence;
+				entry.valid = true;
+				entry.state = state;
+			}
+
+			void clear() {
+				for (Entry& entry : m_entries) {
+					entry.valid = false;
+				}
+			}
+
+		private:
+			struct Entry {
+				uint32_t sequence = 0;
+				bool valid = false;
+				State state{};
+			};
+
+			std::array<Entry, Capacity> m_entries;
+		};
+
+		// true if sequence `a` is newer than `b`, allowing for wrap around
+		constexpr bool sequence_newer(uint32_t a, uint32_t b) {
+			return static_cast<int32_t>(a - b) > 0;
+		}
+
+		// Sender side of a snapshot stream, keep one per client.
+		//
+		// Every snapshot is encoded as a delta against the newest snapshot the client acknowledged,
+		// or in full if it hasn't acknowledged any that's still in the ring.
+		// Wire layout: uint32_t sequence, uint8_t has baseline, [uint32_t baseline sequence, delta] or the full state.
+		template <Reflected State, std::size_t Capacity = SNAPSHOT_DEFAULT_HISTORY>
+		class SnapshotSender {
+		public:
+			template <class Writer>
+			void encode(Writer& writer, uint32_t sequence, State const& state) {
+				State const* baseline = m_hasAck ? m_history.find(m_ackedSequence) : nullptr;
+				writer << sequence;
+				if (baseline != nullptr) {
+					writer << uint8_t(1) << m_ackedSequence;
+					DeltaCodec<State>::write(writer, *baseline, state);
+				}
+				else {
+					writer << uint8_t(0) << state;
+				}
+				m_history.store(sequence, state);
+			}
+
+			// the client received snapshot `sequence`, so it can serve as a baseline from now on
+			void acknowledge(uint32_t sequence) {
+				if (!m_hasAck || sequence_newer(sequence, m_ackedSequence)) {
+					m_ackedSequence = sequence;
+					m_hasAck = true;
+				}
+			}
+
+			// forget every baseline, the next snapshot goes out in full
+			void reset() {
+				m_hasAck = false;
+				m_history.clear();
+			}
+
+		private:
+			SnapshotRing<State, Capacity> m_history;
+			uint32_t m_ackedSequence = 0;
+			bool m_hasAck = false;
+		};
+
+		// Receiver side of a snapshot stream
+		template <Reflected State, std::size_t Capacity = SNAPSHOT_DEFAULT_HISTORY>
+		class SnapshotReceiver {
+		public:
+			// rebuilds the full state into `state` and returns true, the caller should then acknowledge `sequence`.
+			// returns false if the snapshot is older than the latest one, its baseline is gone or it's malformed.
+			bool decode(MessageReader& reader, uint32_t& sequence, State& state) {
+				uint8_t hasBaseline = 0;
+				reader >> sequence >> hasBaseline;
+				if (!reader || (m_hasLatest && !sequence_newer(sequence, m_latestSequence))) {
+					return false;
+				}
+
+				if (hasBaseline) {
+					uint32_t baselineSequence = 0;
+					reader >> baselineSequence;
+					State const* baseline = m_history.find(baselineSequence);
+					if (baseline == nullptr) {
+						return false;
+					}
+					DeltaCodec<State>::read(reader, *baseline, state);
+				}
+				else {
+					reader >> state;
+				}
+
+				if (!reader) {
+					return false;
+				}
+				m_history.store(sequence, state);
+				m_latestSequence = sequence;
+				m_hasLatest = true;
+				return true;
+			}
+
+		private:
+			SnapshotRing<State, Capacity> m_history;
+			uint32_t m_latestSequence = 0;
+			bool m_hasLatest = false;
+		};
+	}
+}
@@ -12,7 +12,10 @@
 
 #include "Message.h"
 #include "Connection.h"
+#include "Log.h"
 #include "ASIOSocket.h"
+#include "RingQueue.h"
+#include "Server.h"
 
 
 
@@ -25,18 +28,19 @@ enum class Commands {
 
 template <class T>
 requires std::is_enum_v<T>
-using ProtocolHandlers = std::map < T, bool(Message<T>&)>;
+using ProtocolHandlers = std::map < T, bool(SmallMessage<T>&)>;
 
 using MyProtocol = ProtocolHandlers<Commands>;
 
-using GameMessage = Message<Commands>;
+using GameMessage = SmallMessage<Commands>;
 //using GameConnection = ConnectionBase<OwnedMessage<GameMessage>, ASIOAsyncUDPSocket, DefualtUDPMessageProcessor<GameMessage>, ThreadSafeQueue<OwnedMessage<GameMessage>>>;
 using GameConnection = UDPConnection<GameMessage>;
+using IncomingQueue = MPSCRingQueue<OwnedMessage<GameMessage>>;
 
 
 struct ServerConnection : public GameConnection {
 public:
-	ServerConnection(ASIO_UDP& socket, ThreadSafeQueue<OwnedMessage<GameMessage>>& queue)
+	ServerConnection(ASIO_UDP& socket, IncomingQueue& queue)
 		: m_inQueue(queue)
 		, GameConnection(socket)
 	{
@@ -44,7 +48,7 @@ public:
 	}
 
 	void on_receive(GameMessage& msg) override {
-		std::cout << "Message from: " << this->remote_endpoint() << std::endl;
+		NET_LOG_DEBUG("Message from: ", this->remote_endpoint());
 		auto smsg = OwnedMessage<GameMessage>(msg, this->remote_endpoint());
 		m_inQueue.push_back(smsg);
 	}
@@ -53,29 +57,36 @@ public:
 		: ServerConnection(sc.m_socket, sc.m_inQueue)
 	{}
 
-	ThreadSafeQueue<OwnedMessage<GameMessage>>& incoming() {
+	IncomingQueue& incoming() {
 		return m_inQueue;
 	}
 
 private:
-	ThreadSafeQueue<OwnedMessage<GameMessage>>& m_inQueue;
+	IncomingQueue& m_inQueue;
+};
+
+
+// one socket, thread and queue per core, all on port 3741
+struct GameServer : public ShardedUDPServer<ServerConnection, IncomingQueue> {
+	using ShardedUDPServer<ServerConnection, IncomingQueue>::ShardedUDPServer;
+
+protected:
+	void on_message(ServerConnection& connection, OwnedMessage<GameMessage>& msg) override {
+		NET_LOG_DEBUG("Sending ", msg, " to: ", msg.endpoint());
+		connection.send_message(std::move(msg));
+	}
 };
 
 
 GameMessage msg;
-ThreadSafeQueue<OwnedMessage<GameMessage>> q;
-asio::io_context ctx = asio::io_context();
-asio::ip::udp::socket sock = asio::ip::udp::socket{ ctx, asio::ip::udp::endpoint(asio::ip::udp::v4(), 3741) };
-ServerConnection conn = ServerConnection{ sock, q };
+GameServer server;
 
 
-void protocol_core(ThreadSafeQueue<OwnedMessage<GameMessage>>& q) {
+void protocol_core(GameServer& server) {
 	while (true)
 	{
-		q.wait();
-		auto msg = q.pop_front();
-		std::cout << "Sending " << msg <<  " to: " << msg.endpoint() << std::endl;
-		conn.send_message(msg);
+		server.wait();
+		server.update();
 	}
 }
 
@@ -84,13 +95,12 @@ int main() {
 	msg.header.m_id = Commands::Chat;
 	msg << std::string("Hello, World!");
 	try {
-		conn.listen_for_messages();
-		std::thread asyncThread{ [&]() { ctx.run(); } };
+		server.start(3741);
 
-		protocol_core(q);
+		protocol_core(server);
 	}
 	catch (std::exception& e) {
-		std::cout << "[SERVER] Exception: " << e.what() << std::endl;
+		NET_LOG_ERROR("[SERVER] Exception: ", std::string(e.what()));
 		return false;
 	}
 
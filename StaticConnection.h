@@ -0,0 +1,350 @@
+#pragma once
+
+#include <cstring>
+#include <span>
+#include <system_error>
+
+#include "./ASIOSocket.h"
+#include "./Connection.h"
+#include "./Errors.h"
+#include "./HeaderCodec.h"
+#include "./IAsyncIO.h"
+#include "./IMessage.h"
+#include "./IQueue.h"
+#include "./Metrics.h"
+#include "./ThreadSafeQueue.h"
+
+
+namespace xpo {
+	namespace net {
+		// TCPConnection with every per-packet call resolved at compile time.
+		// Derived is the connection itself (CRTP) and is the message processor: it hides whichever of on_receive(),
+		// on_receive_header(), on_send(), on_receive_fail(), on_send_fail() and collapse_key() it cares about,
+		// the rest default to doing nothing. They have to be public, since they're called from outside the class.
+		// IO is any IStaticAsyncByteIO backend and framing is the same StreamFramer TCPConnection uses, so the two
+		// behave the same on the wire, this one just has no virtual calls between the socket and the handler.
+		//
+		//     struct GameConnection : StaticTCPConnection<GameConnection, GameMessage> {
+		//         using StaticTCPConnection::StaticTCPConnection;
+		//         void on_receive(GameMessage& msg) { ... }
+		//     };
+		template <class Derived, IByteMessage T, IStaticAsyncByteIO IO = ASIOStaticTCPSocket, IQueue<T> Q = ThreadSafeQueue<T>>
+		struct StaticTCPConnection : public IO {
+			using IO::IO;
+
+			using header_codec = HeaderCodec<typename T::header_type>;
+
+			static inline constexpr size_t const MAX_MESSAGE_BODY_SIZE = 1024;
+
+			// what the out queue's overflow policy did with the message, see SendBackpressure::reserve()
+			PushResult send_message(T const& msg) {
+				PushResult result = m_backpressure.reserve();
+				if (result == PushResult::Dropped) {
+					m_metrics.sendDrops.add_shared();
+					return result;
+				}
+				this->execute_async([this, msg]() {
+					m_backpressure.arrived();
+					send_message_async(msg);
+				});
+				return result;
+			}
+
+			PushResult send_message(T&& msg) {
+				PushResult result = m_backpressure.reserve();
+				if (result == PushResult::Dropped) {
+					m_metrics.sendDrops.add_shared();
+					return result;
+				}
+				this->execute_async([this, msg = std::move(msg)]() mutable {
+					m_backpressure.arrived();
+					send_message_async(std::move(msg));
+				});
+				return result;
+			}
+
+			void listen_for_messages() {
+				this->execute_async([this]() {
+					m_framer.allocate();
+					stream_receive_async();
+				});
+			}
+
+			ConnectionMetricsSnapshot metrics_snapshot() const {
+				return m_metrics.snapshot();
+			}
+
+			ConnectionMetrics const& metrics() const {
+				return m_metrics;
+			}
+
+			size_t out_queue_limit() const {
+				return m_backpressure.limit();
+			}
+
+			void out_queue_limit(size_t limit) {
+				m_backpressure.limit(limit);
+			}
+
+			OverflowPolicy overflow_policy() const {
+				return m_backpressure.policy();
+			}
+
+			void overflow_policy(OverflowPolicy policy) {
+				m_backpressure.policy(policy);
+			}
+
+			size_t out_queue_pending() const {
+				return m_backpressure.pending();
+			}
+
+			size_t in_buffer_size() const {
+				return m_framer.buffer_size();
+			}
+
+			// only before listen_for_messages()
+			void in_buffer_size(size_t size) {
+				m_framer.buffer_size(size);
+			}
+
+			// defaults, hidden by Derived's own
+			void on_receive(T&) {}
+
+			bool on_receive_header(typename T::header_type& header) {
+				return header.size() <= MAX_MESSAGE_BODY_SIZE;
+			}
+
+			void on_send(T&) {}
+
+			// messages with equal keys take each other's place in the out queue under OverflowPolicy::Collapse
+			uint64_t collapse_key(T const& msg) {
+				return static_cast<uint64_t>(msg.header.m_id);
+			}
+
+			bool on_receive_fail(std::error_code) {
+				return true;
+			}
+
+			bool on_send_fail(std::error_code) {
+				return true;
+			}
+
+		protected:
+			Derived& derived() {
+				return static_cast<Derived&>(*this);
+			}
+
+			void send_message_async(T const& msg) {
+				queue_out_message(msg);
+			}
+
+			void send_message_async(T&& msg) {
+				queue_out_message(std::move(msg));
+			}
+
+			// the io thread's half of SendBackpressure, like ConnectionBase::queue_out_message()
+			template <class U>
+			void queue_out_message(U&& msg) {
+				if (m_outCount >= m_backpressure.limit()) {
+					switch (m_backpressure.policy()) {
+					case OverflowPolicy::Block:
+						break;
+					case OverflowPolicy::DropNewest:
+						m_metrics.sendDrops.add_shared();
+						return;
+					case OverflowPolicy::DropOldest:
+						if (m_outCount > 0) {
+							pop_out_message();
+						}
+						m_metrics.sendDrops.add_shared();
+						break;
+					case OverflowPolicy::Collapse:
+						// a queued message with the same key makes way for this one, failing that the oldest does
+						if constexpr (requires { m_outQueue.replace_last_if([](T const&) { return true; }, std::forward<U>(msg)); }) {
+							uint64_t key = derived().collapse_key(msg);
+							if (m_outQueue.replace_last_if([this, key](T const& queued) { return derived().collapse_key(queued) == key; }, std::forward<U>(msg))) {
+								m_metrics.sendCollapses.add();
+								return;
+							}
+						}
+						if (m_outCount > 0) {
+							pop_out_message();
+						}
+						m_metrics.sendDrops.add_shared();
+						break;
+					}
+				}
+
+				m_outQueue.push_back(std::forward<U>(msg));
+				queued_out_message();
+				if (!m_sending) {
+					m_sending = true;
+					message_send_async();
+				}
+			}
+
+			void continue_send_async() {
+				if (m_outQueue.empty()) {
+					m_sending = false;
+				}
+				else {
+					message_send_async();
+				}
+			}
+
+			void queued_out_message() {
+				m_backpressure.queued(++m_outCount);
+				m_metrics.outQueueDepth.add();
+				if constexpr (NET_METRICS) {
+					// unsampled messages get an empty time
+					m_outQueueTimes.push_back(m_metrics.sample() ? ConnectionMetrics::clock::now() : ConnectionMetrics::clock::time_point());
+				}
+			}
+
+			T pop_out_message() {
+				m_backpressure.queued(--m_outCount);
+				m_metrics.outQueueDepth.sub();
+				if constexpr (NET_METRICS) {
+					auto queued = m_outQueueTimes.pop_front();
+					if (queued != ConnectionMetrics::clock::time_point()) {
+						m_metrics.queueResidency.record_since(queued);
+					}
+				}
+				return m_outQueue.pop_front();
+			}
+
+			bool receive_failed(std::error_code ec) {
+				if (ec == make_error_code(ErrorCode::InvalidHeader)) {
+					m_metrics.invalidHeaders.add();
+				}
+				else {
+					m_metrics.receiveFailures.add();
+				}
+				return derived().on_receive_fail(ec);
+			}
+
+			void dispatch_receive(T& msg) {
+				m_metrics.packetsIn.add();
+				m_metrics.time_handler([this, &msg]() {
+					derived().on_receive(msg);
+				});
+			}
+
+			// hands the framer's calls to Derived, counting them in m_metrics on the way
+			struct MeteredReceiver {
+				StaticTCPConnection& connection;
+
+				void on_receive(T& msg) {
+					connection.dispatch_receive(msg);
+				}
+
+				bool on_receive_header(typename T::header_type& header) {
+					if (connection.derived().on_receive_header(header)) {
+						return true;
+					}
+					connection.m_metrics.headerDrops.add();
+					return false;
+				}
+
+				bool on_receive_fail(std::error_code ec) {
+					return connection.receive_failed(ec);
+				}
+			};
+
+			void send_failed(std::error_code ec) {
+				m_metrics.sendFailures.add();
+				if (derived().on_send_fail(ec)) {
+					continue_send_async();
+				}
+				else {
+					m_sending = false;
+				}
+			}
+
+			// reads whatever the socket has into the free end of the read buffer
+			void stream_receive_async() {
+				this->read_some_async(m_framer.free_space(), m_framer.free_size(), [this](std::error_code ec, size_t length) {
+					if (!ec) {
+						m_metrics.bytesIn.add(length);
+						m_framer.received(length);
+						parse_frames_from_byte_stream();
+					}
+					else {
+						if (receive_failed(ec)) {
+							stream_receive_async();
+						}
+					}
+					});
+			}
+
+			void parse_frames_from_byte_stream() {
+				MeteredReceiver receiver{ *this };
+				switch (m_framer.parse(m_tempInMessage, receiver)) {
+				case StreamFramer<T>::Next::Read:
+					stream_receive_async();
+					break;
+				case StreamFramer<T>::Next::ReadBody:
+					body_receive_async();
+					break;
+				case StreamFramer<T>::Next::Stop:
+					break;
+				}
+			}
+
+			// reads the rest of a large body directly into the message's own storage
+			void body_receive_async() {
+				size_t remaining = m_framer.body_remaining(m_tempInMessage);
+				this->read_async(m_framer.body_space(m_tempInMessage), remaining, [this, remaining](std::error_code ec, size_t length) {
+					if (!ec && length == remaining) {
+						m_metrics.bytesIn.add(length);
+						dispatch_receive(m_tempInMessage);
+						stream_receive_async();
+					}
+					else {
+						if (receive_failed(ec)) {
+							stream_receive_async();
+						}
+					}
+					});
+			}
+
+			// header and body go out in a single gather write
+			void message_send_async() {
+				m_tempOutMessage = pop_out_message();
+				derived().on_send(m_tempOutMessage);
+				size_t headerSize = header_codec::encode(m_tempOutMessage.header, m_headerOutBuffer);
+				if (headerSize == 0) {
+					send_failed(make_error_code(ErrorCode::MessageTooLarge));
+					return;
+				}
+				size_t bodySize = m_tempOutMessage.header.size();
+				ConstByteBuffer buffers[2] = {
+					{ m_headerOutBuffer, headerSize },
+					{ m_tempOutMessage.data(), bodySize }
+				};
+				this->write_async(std::span<ConstByteBuffer const>(buffers, bodySize > 0 ? 2 : 1), [this, total = headerSize + bodySize](std::error_code ec, size_t length) {
+					if (!ec && length == total) {
+						m_metrics.bytesOut.add(length);
+						m_metrics.packetsOut.add();
+						continue_send_async();
+					}
+					else {
+						send_failed(ec);
+					}
+					});
+			}
+
+			StreamFramer<T> m_framer;
+			T m_tempInMessage;
+			T m_tempOutMessage;
+			Q m_outQueue;
+			Deque<ConnectionMetrics::clock::time_point> m_outQueueTimes;
+			size_t m_outCount = 0;
+			SendBackpressure m_backpressure;
+			bool m_sending = false;
+			ConnectionMetrics m_metrics;
+
+			uint8_t m_headerOutBuffer[header_codec::max_size];
+		};
+	}
+}
@@ -1,7 +1,12 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <deque>
 #include <mutex>
+#include <stdint.h>
 
 #include "./IQueue.h"
 
@@ -31,6 +36,10 @@ namespace xpo {
 				std::deque<T>::emplace_back(item);
 			}
 
+			void push_back(T&& item) {
+				std::deque<T>::emplace_back(std::move(item));
+			}
+
 			bool empty() {
 				return std::deque<T>::empty();
 			}
@@ -54,8 +63,33 @@ namespace xpo {
 				std::deque<T>::pop_back();
 				return t;
 			}
+
+			// replaces the newest item `pred` accepts with `item`, returns false if there is none
+			template <class Pred, class U>
+			bool replace_last_if(Pred&& pred, U&& item) {
+				for (auto it = std::deque<T>::rbegin(); it != std::deque<T>::rend(); ++it) {
+					if (pred(*it)) {
+						*it = std::forward<U>(item);
+						return true;
+					}
+				}
+				return false;
+			}
+
+			template <class Container>
+			size_t drain_into(Container& out, size_t max = SIZE_MAX) {
+				size_t count = std::min(max, std::deque<T>::size());
+				auto begin = std::deque<T>::begin();
+				for (auto it = begin; it != begin + count; ++it) {
+					out.push_back(std::move(*it));
+				}
+				std::deque<T>::erase(begin, begin + count);
+				return count;
+			}
 		};
 
+		// Unbounded unless limit() is set, then a push_back() into a full queue does what overflow_policy() says
+		// and returns what became of the item.
 		template <class T, IDeque<T> Q = Deque<T>>
 		class ThreadSafeQueue {
 		public:
@@ -75,18 +109,47 @@ namespace xpo {
 
 			void push_front(T const& item) {
 				std::scoped_lock lock(m_mutex);
-				m_deque.push_back(item);
+				m_deque.push_front(item);
+				m_depth.store(m_deque.size(), std::memory_order_relaxed);
+				m_cvItems.notify_one();
+			}
 
-				std::unique_lock<std::mutex> ul(m_mutexBlocking);
-				m_cvBlocking.notify_one();
+			PushResult push_back(T const& item) {
+				return push(item);
 			}
 
-			void push_back(T const& item) {
+			PushResult push_back(T&& item) {
+				return push(std::move(item));
+			}
+
+			// items the queue holds at most, SIZE_MAX for no bound
+			size_t limit() {
+				std::scoped_lock lock(m_mutex);
+				return m_limit;
+			}
+
+			void limit(size_t limit) {
+				std::scoped_lock lock(m_mutex);
+				m_limit = limit;
+				m_cvSpace.notify_all();
+			}
+
+			OverflowPolicy overflow_policy() {
 				std::scoped_lock lock(m_mutex);
-				m_deque.push_back(item);
+				return m_policy;
+			}
 
-				std::unique_lock<std::mutex> ul(m_mutexBlocking);
-				m_cvBlocking.notify_one();
+			void overflow_policy(OverflowPolicy policy) {
+				std::scoped_lock lock(m_mutex);
+				m_policy = policy;
+				m_cvSpace.notify_all();
+			}
+
+			// what OverflowPolicy::Collapse compares, a pushed item replaces a queued one with an equal key.
+			// without one, Collapse drops the pushed item.
+			void collapse_key(uint64_t(*key)(T const&)) {
+				std::scoped_lock lock(m_mutex);
+				m_collapseKey = key;
 			}
 
 			bool empty() {
@@ -101,13 +164,15 @@ namespace xpo {
 
 			void clear() {
 				std::scoped_lock lock(m_mutex);
-				return m_deque.clear();
+				m_deque.clear();
+				freed();
 			}
 
 			T pop_front() {
 				std::scoped_lock lock(m_mutex);
 				auto t = std::move(m_deque.front());
 				m_deque.pop_front();
+				freed();
 				return t;
 			}
 
@@ -115,22 +180,104 @@ namespace xpo {
 				std::scoped_lock lock(m_mutex);
 				auto t = std::move(m_deque.back());
 				m_deque.pop_back();
+				freed();
 				return t;
 			}
 
+			// replaces the newest item `pred` accepts with `item`, returns false if there is none
+			template <class Pred, class U>
+			bool replace_last_if(Pred&& pred, U&& item) {
+				std::scoped_lock lock(m_mutex);
+				return m_deque.replace_last_if(std::forward<Pred>(pred), std::forward<U>(item));
+			}
+
+			// moves up to `max` items out under a single lock
+			template <class Container>
+			size_t drain_into(Container& out, size_t max = SIZE_MAX) {
+				std::scoped_lock lock(m_mutex);
+				size_t count = m_deque.drain_into(out, max);
+				freed();
+				return count;
+			}
+
+			// size() without taking the lock, for gauges; it may be a moment out of date
+			size_t depth() const {
+				return m_depth.load(std::memory_order_relaxed);
+			}
+
 			void wait() {
-				while (empty()) {
-					std::unique_lock<std::mutex> ul(m_mutexBlocking);
-					m_cvBlocking.wait(ul);
-				}
+				std::unique_lock<std::mutex> lock(m_mutex);
+				m_cvItems.wait(lock, [this]() { return !m_deque.empty(); });
+			}
+
+			// returns false if the queue is still empty after `timeout`
+			template <class Rep, class Period>
+			bool wait_for(std::chrono::duration<Rep, Period> const& timeout) {
+				auto deadline = std::chrono::steady_clock::now() + timeout;
+				std::unique_lock<std::mutex> lock(m_mutex);
+				return m_cvItems.wait_until(lock, deadline, [this]() { return !m_deque.empty(); });
 			}
 
 		protected:
+			template <class U>
+			PushResult push(U&& item) {
+				PushResult result = PushResult::Queued;
+				{
+					std::unique_lock<std::mutex> lock(m_mutex);
+					if (m_deque.size() >= m_limit) {
+						switch (m_policy) {
+						case OverflowPolicy::Block:
+							m_cvSpace.wait(lock, [this]() {
+								return m_deque.size() < m_limit || m_policy != OverflowPolicy::Block;
+							});
+							result = PushResult::Waited;
+							break;
+						case OverflowPolicy::DropNewest:
+							return PushResult::Dropped;
+						case OverflowPolicy::DropOldest:
+							// a limit of 0 leaves nothing to drop
+							if (!m_deque.empty()) {
+								m_deque.pop_front();
+								result = PushResult::DroppedOldest;
+							}
+							break;
+						case OverflowPolicy::Collapse:
+							if constexpr (requires { m_deque.replace_last_if([](T const&) { return true; }, std::forward<U>(item)); }) {
+								if (m_collapseKey != nullptr) {
+									uint64_t key = m_collapseKey(item);
+									if (m_deque.replace_last_if([this, key](T const& queued) { return m_collapseKey(queued) == key; }, std::forward<U>(item))) {
+										return PushResult::Collapsed;
+									}
+								}
+							}
+							return PushResult::Dropped;
+						}
+					}
+					m_deque.push_back(std::forward<U>(item));
+					m_depth.store(m_deque.size(), std::memory_order_relaxed);
+					m_cvItems.notify_one();
+				}
+				return result;
+			}
+
+			// called with m_mutex held after items were taken out
+			void freed() {
+				m_depth.store(m_deque.size(), std::memory_order_relaxed);
+				if (m_policy == OverflowPolicy::Block && m_limit != SIZE_MAX) {
+					m_cvSpace.notify_all();
+				}
+			}
+
 			std::mutex m_mutex;
 			Q m_deque;
-
-			std::condition_variable m_cvBlocking;
-			std::mutex m_mutexBlocking;
+			std::atomic<size_t> m_depth = 0;
+			size_t m_limit = SIZE_MAX;
+			OverflowPolicy m_policy = OverflowPolicy::DropNewest;
+			uint64_t(*m_collapseKey)(T const&) = nullptr;
+			// producers blocked on a full queue wait here
+			std::condition_variable m_cvSpace;
+			// consumers in wait() and wait_for() wait here, on m_mutex like everything else
+			std::condition_variable m_cvItems;
 		};
 	}
 }
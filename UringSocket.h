@@ -0,0 +1,853 @@
+#pragma once
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#define GAMECORE_NET_HAS_IO_URING 1
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <asio/ts/net.hpp>
+
+#include "./BatchedUDPSocket.h"
+#include "./IAsyncIO.h"
+
+// submission queue entries per context
+#ifndef URING_DEFAULT_QUEUE_DEPTH
+#define URING_DEFAULT_QUEUE_DEPTH 256
+#endif
+
+// provided buffers shared by every socket of a context, must be a power of two
+#ifndef URING_DEFAULT_BUFFER_COUNT
+#define URING_DEFAULT_BUFFER_COUNT 1024
+#endif
+
+// a UDP buffer also holds the io_uring_recvmsg_out header and the source address in front of the payload
+#ifndef URING_DEFAULT_BUFFER_SIZE
+#define URING_DEFAULT_BUFFER_SIZE 2048
+#endif
+
+namespace xpo {
+	namespace net {
+		// an operation in flight, the sqe's user_data points at it.
+		// sockets keep theirs as members and set `complete` once, so submitting never allocates.
+		struct UringOperation {
+			InplaceFunction<void(int, uint32_t), ASYNC_IO_CALLBACK_SIZE> complete;
+		};
+
+		// An io_uring instance driven by one thread calling run(), the io_uring counterpart of asio::io_context.
+		// Talks to the kernel ABI directly, there's no liburing dependency.
+		// Receives land in a ring of provided buffers registered with the kernel (IORING_REGISTER_PBUF_RING),
+		// which lets a single multishot receive per socket keep delivering without a submission per read.
+		// Needs Linux 6.0 or newer for multishot recv/recvmsg with provided buffer rings.
+		//
+		// Only post() and stop() may be called from other threads.
+		class UringContext {
+		public:
+			static constexpr uint16_t const buffer_group = 0;
+
+			explicit UringContext(unsigned entries = URING_DEFAULT_QUEUE_DEPTH, uint16_t bufferCount = URING_DEFAULT_BUFFER_COUNT, size_t bufferSize = URING_DEFAULT_BUFFER_SIZE)
+				: m_bufferCount(bufferCount)
+				, m_bufferSize(bufferSize)
+			{
+				if (bufferCount == 0 || (bufferCount & (bufferCount - 1)) != 0) {
+					throw std::invalid_argument("io_uring buffer count must be a power of two");
+				}
+
+				io_uring_params params{};
+				m_fd = static_cast<int>(::syscall(__NR_io_uring_setup, entries, &params));
+				if (m_fd < 0) {
+					throw std::system_error(errno, std::system_category(), "io_uring_setup");
+				}
+				map_rings(params);
+				register_buffers();
+
+				m_wakeFd = ::eventfd(0, EFD_CLOEXEC);
+				if (m_wakeFd < 0) {
+					throw std::system_error(errno, std::system_category(), "eventfd");
+				}
+				m_wakeOp.complete = [this](int res, uint32_t flags) {
+					on_wake();
+				};
+				arm_wake();
+			}
+
+			UringContext(UringContext const&) = delete;
+			UringContext& operator=(UringContext const&) = delete;
+
+			~UringContext() {
+				if (m_wakeFd >= 0) {
+					::close(m_wakeFd);
+				}
+				if (m_bufferRing != nullptr) {
+					::munmap(m_bufferRing, m_bufferCount * sizeof(io_uring_buf));
+				}
+				if (m_sqes != nullptr) {
+					::munmap(m_sqes, m_sqEntries * sizeof(io_uring_sqe));
+				}
+				if (m_cqRing != nullptr && m_cqRing != m_sqRing) {
+					::munmap(m_cqRing, m_cqRingSize);
+				}
+				if (m_sqRing != nullptr) {
+					::munmap(m_sqRing, m_sqRingSize);
+				}
+				if (m_fd >= 0) {
+					::close(m_fd);
+				}
+			}
+
+			// runs completions until stop() is called
+			void run() {
+				m_runningThread = std::this_thread::get_id();
+				m_stopped.store(false, std::memory_order_relaxed);
+				while (!m_stopped.load(std::memory_order_acquire)) {
+					run_deferred();
+					// don't block while there's deferred work left
+					submit(m_deferred.empty() ? 1 : 0);
+					reap();
+				}
+				m_runningThread = std::thread::id();
+			}
+
+			void stop() {
+				m_stopped.store(true, std::memory_order_release);
+				wake();
+			}
+
+			// runs `f` on the run() thread, from any thread
+			void post(IOTask f) {
+				{
+					std::lock_guard<std::mutex> lock(m_postedMutex);
+					m_posted.push_back(std::move(f));
+				}
+				wake();
+			}
+
+			// runs `f` on the run() thread once the current completion is done, run() thread only.
+			// used to complete an operation without calling back into the code that started it.
+			void defer(IOTask f) {
+				m_deferred.push_back(std::move(f));
+			}
+
+			bool running_in_this_thread() const {
+				return m_runningThread == std::this_thread::get_id();
+			}
+
+			// the next submission queue entry, sent to the kernel the next time run() waits
+			io_uring_sqe& prepare(UringOperation* op, uint8_t opcode, int fd) {
+				unsigned head = std::atomic_ref<unsigned>(*m_sqHead).load(std::memory_order_acquire);
+				if (m_sqTail - head >= m_sqEntries) {
+					submit(0);
+				}
+				unsigned index = m_sqTail & m_sqMask;
+				io_uring_sqe& sqe = m_sqes[index];
+				std::memset(&sqe, 0, sizeof(sqe));
+				sqe.opcode = opcode;
+				sqe.fd = fd;
+				sqe.user_data = reinterpret_cast<uint64_t>(op);
+				m_sqArray[index] = index;
+				++m_sqTail;
+				return sqe;
+			}
+
+			// hands everything prepared so far to the kernel, optionally waiting for completions
+			void submit(unsigned waitFor) {
+				std::atomic_ref<unsigned>(*m_sqKernelTail).store(m_sqTail, std::memory_order_release);
+				unsigned count = m_sqTail - m_sqSubmitted;
+				m_sqSubmitted = m_sqTail;
+				if (count == 0 && waitFor == 0) {
+					return;
+				}
+				while (::syscall(__NR_io_uring_enter, m_fd, count, waitFor, waitFor > 0 ? IORING_ENTER_GETEVENTS : 0, nullptr, 0) < 0) {
+					if (errno != EINTR) {
+						// EBUSY/EAGAIN mean the completion queue is full, reaping makes room
+						break;
+					}
+				}
+			}
+
+			uint8_t* buffer(uint16_t id) {
+				return m_buffers.get() + static_cast<size_t>(id) * m_bufferSize;
+			}
+
+			size_t buffer_size() const {
+				return m_bufferSize;
+			}
+
+			// gives a provided buffer back to the kernel
+			void recycle(uint16_t id) {
+				// not m_bufferRing->bufs, the kernel header's flexible array lands at the wrong offset in C++
+				io_uring_buf& buf = reinterpret_cast<io_uring_buf*>(m_bufferRing)[m_bufferTail & (m_bufferCount - 1)];
+				buf.addr = reinterpret_cast<uint64_t>(buffer(id));
+				buf.len = static_cast<uint32_t>(m_bufferSize);
+				buf.bid = id;
+				++m_bufferTail;
+				std::atomic_ref<uint16_t>(m_bufferRing->tail).store(m_bufferTail, std::memory_order_release);
+
+				if (!m_bufferWaiters.empty()) {
+					for (auto& waiter : m_bufferWaiters) {
+						defer(std::move(waiter));
+					}
+					m_bufferWaiters.clear();
+				}
+			}
+
+			// `f` runs once a buffer was recycled, for receives that stopped with ENOBUFS
+			void wait_for_buffers(IOTask f) {
+				m_bufferWaiters.push_back(std::move(f));
+			}
+
+		private:
+			void map_rings(io_uring_params const& params) {
+				m_sqEntries = params.sq_entries;
+				m_sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+				m_cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+				if (params.features & IORING_FEAT_SINGLE_MMAP) {
+					m_sqRingSize = m_cqRingSize = std::max(m_sqRingSize, m_cqRingSize);
+				}
+
+				m_sqRing = map(m_sqRingSize, IORING_OFF_SQ_RING);
+				m_cqRing = (params.features & IORING_FEAT_SINGLE_MMAP) ? m_sqRing : map(m_cqRingSize, IORING_OFF_CQ_RING);
+				m_sqes = static_cast<io_uring_sqe*>(map(params.sq_entries * sizeof(io_uring_sqe), IORING_OFF_SQES));
+
+				uint8_t* sq = static_cast<uint8_t*>(m_sqRing);
+				m_sqHead = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+				m_sqKernelTail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+				m_sqMask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+				m_sqArray = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+				m_sqTail = m_sqSubmitted = *m_sqKernelTail;
+
+				uint8_t* cq = static_cast<uint8_t*>(m_cqRing);
+				m_cqHead = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+				m_cqTail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+				m_cqMask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+				m_cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+			}
+
+			void* map(size_t size, off_t offset) {
+				void* ptr = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, offset);
+				if (ptr == MAP_FAILED) {
+					throw std::system_error(errno, std::system_category(), "io_uring mmap");
+				}
+				return ptr;
+			}
+
+			void register_buffers() {
+				m_buffers = std::make_unique<uint8_t[]>(m_bufferCount * m_bufferSize);
+				void* ring = ::mmap(nullptr, m_bufferCount * sizeof(io_uring_buf), PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+				if (ring == MAP_FAILED) {
+					throw std::system_error(errno, std::system_category(), "io_uring buffer ring mmap");
+				}
+				m_bufferRing = static_cast<io_uring_buf_ring*>(ring);
+
+				io_uring_buf_reg reg{};
+				reg.ring_addr = reinterpret_cast<uint64_t>(m_bufferRing);
+				reg.ring_entries = m_bufferCount;
+				reg.bgid = buffer_group;
+				if (::syscall(__NR_io_uring_register, m_fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+					throw std::system_error(errno, std::system_category(), "io_uring_register(PBUF_RING)");
+				}
+				for (uint16_t id = 0; id < m_bufferCount; ++id) {
+					recycle(id);
+				}
+			}
+
+			void reap() {
+				unsigned head = *m_cqHead;
+				unsigned tail = std::atomic_ref<unsigned>(*m_cqTail).load(std::memory_order_acquire);
+				while (head != tail) {
+					io_uring_cqe cqe = m_cqes[head & m_cqMask];
+					++head;
+					// free the slot first, completions may queue more work
+					std::atomic_ref<unsigned>(*m_cqHead).store(head, std::memory_order_release);
+					if (auto op = reinterpret_cast<UringOperation*>(cqe.user_data)) {
+						op->complete(cqe.res, cqe.flags);
+					}
+				}
+			}
+
+			void run_deferred() {
+				// completions may defer more, those run on the next pass
+				m_running.swap(m_deferred);
+				for (auto& f : m_running) {
+					f();
+				}
+				m_running.clear();
+			}
+
+			void wake() {
+				uint64_t one = 1;
+				[[maybe_unused]] auto written = ::write(m_wakeFd, &one, sizeof(one));
+			}
+
+			void arm_wake() {
+				io_uring_sqe& sqe = prepare(&m_wakeOp, IORING_OP_READ, m_wakeFd);
+				sqe.addr = reinterpret_cast<uint64_t>(&m_wakeValue);
+				sqe.len = sizeof(m_wakeValue);
+			}
+
+			void on_wake() {
+				arm_wake();
+				{
+					std::lock_guard<std::mutex> lock(m_postedMutex);
+					m_runningPosted.swap(m_posted);
+				}
+				// both vectors keep their capacity, so posting stops allocating once they're big enough
+				for (auto& f : m_runningPosted) {
+					f();
+				}
+				m_runningPosted.clear();
+			}
+
+			int m_fd = -1;
+			void* m_sqRing = nullptr;
+			void* m_cqRing = nullptr;
+			size_t m_sqRingSize = 0;
+			size_t m_cqRingSize = 0;
+
+			io_uring_sqe* m_sqes = nullptr;
+			unsigned* m_sqHead = nullptr;
+			unsigned* m_sqKernelTail = nullptr;
+			unsigned* m_sqArray = nullptr;
+			unsigned m_sqMask = 0;
+			unsigned m_sqEntries = 0;
+			unsigned m_sqTail = 0;
+			unsigned m_sqSubmitted = 0;
+
+			io_uring_cqe* m_cqes = nullptr;
+			unsigned* m_cqHead = nullptr;
+			unsigned* m_cqTail = nullptr;
+			unsigned m_cqMask = 0;
+
+			io_uring_buf_ring* m_bufferRing = nullptr;
+			std::unique_ptr<uint8_t[]> m_buffers;
+			uint16_t m_bufferCount;
+			uint16_t m_bufferTail = 0;
+			size_t m_bufferSize;
+			std::vector<IOTask> m_bufferWaiters;
+
+			int m_wakeFd = -1;
+			uint64_t m_wakeValue = 0;
+			UringOperation m_wakeOp;
+
+			std::atomic<bool> m_stopped{ false };
+			std::thread::id m_runningThread;
+			std::mutex m_postedMutex;
+			std::vector<IOTask> m_posted;
+			std::vector<IOTask> m_runningPosted;
+			std::vector<IOTask> m_deferred;
+			std::vector<IOTask> m_running;
+		};
+
+		// Takes ownership of an open socket descriptor, e.g. one released from an asio socket.
+		// Everything but execute_async() must be called on the context's run() thread,
+		// and a socket must be closed and its completions run before it's destroyed.
+		struct UringSocketBase : public IAsyncByteIO {
+			UringSocketBase(UringContext& context, int fd)
+				: m_context(context)
+				, m_fd(fd)
+			{
+				m_recvOp.complete = [this](int res, uint32_t flags) {
+					receive_completed(res, flags);
+				};
+			}
+
+			~UringSocketBase() {
+				close_now();
+			}
+
+			void execute_async(IOTask f) override {
+				m_context.post(std::move(f));
+			}
+
+			void close() override {
+				if (m_context.running_in_this_thread()) {
+					close_now();
+				}
+				else {
+					m_context.post([this]() {
+						close_now();
+					});
+				}
+			}
+
+			bool is_open() override {
+				return m_fd >= 0;
+			}
+
+			int native_handle() const {
+				return m_fd;
+			}
+
+			UringContext& context() {
+				return m_context;
+			}
+
+		protected:
+			struct Chunk {
+				uint16_t id;
+				uint32_t offset;
+				uint32_t size;
+			};
+
+			void close_now() {
+				if (m_fd < 0) {
+					return;
+				}
+				// cancel our multishot receive and anything else in flight, they complete with ECANCELED
+				io_uring_sqe& sqe = m_context.prepare(nullptr, IORING_OP_ASYNC_CANCEL, m_fd);
+				sqe.cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+				m_context.submit(0);
+				::close(m_fd);
+				m_fd = -1;
+				for (auto& chunk : m_chunks) {
+					m_context.recycle(chunk.id);
+				}
+				m_chunks.clear();
+			}
+
+			virtual void prepare_receive(io_uring_sqe& sqe) = 0;
+
+			virtual void complete_read() = 0;
+
+			// starts the multishot receive if it isn't running, it keeps filling provided buffers until it stops.
+			// an error waiting for a read holds it off until the read took it.
+			void arm_receive() {
+				if (m_recvArmed || m_waitingForBuffers || m_recvError || m_fd < 0) {
+					return;
+				}
+				io_uring_sqe& sqe = m_context.prepare(&m_recvOp, 0, m_fd);
+				prepare_receive(sqe);
+				sqe.flags |= IOSQE_BUFFER_SELECT;
+				sqe.buf_group = UringContext::buffer_group;
+				m_recvArmed = true;
+			}
+
+			void receive_completed(int res, uint32_t flags) {
+				if (!(flags & IORING_CQE_F_MORE)) {
+					m_recvArmed = false;
+				}
+				if (flags & IORING_CQE_F_BUFFER) {
+					uint16_t id = static_cast<uint16_t>(flags >> IORING_CQE_BUFFER_SHIFT);
+					if (res > 0 && m_fd >= 0) {
+						m_chunks.push_back({ id, 0, static_cast<uint32_t>(res) });
+					}
+					else {
+						m_context.recycle(id);
+					}
+				}
+
+				if (res == -ENOBUFS) {
+					// every buffer is queued up somewhere, carry on once one comes back
+					m_waitingForBuffers = true;
+					m_context.wait_for_buffers([this]() {
+						m_waitingForBuffers = false;
+						arm_receive();
+					});
+				}
+				else if (res == -ECANCELED && m_fd < 0) {
+					m_recvError = std::make_error_code(std::errc::operation_canceled);
+					m_recvClosed = true;
+				}
+				else if (res < 0) {
+					m_recvError = std::error_code(-res, std::system_category());
+				}
+				else if (res == 0 && end_of_stream_on_empty()) {
+					m_recvError = std::make_error_code(std::errc::connection_reset);
+					m_recvClosed = true;
+				}
+				arm_receive();
+				complete_read();
+			}
+
+			// a zero byte receive is the end of the stream for TCP, but just an empty datagram for UDP
+			virtual bool end_of_stream_on_empty() const = 0;
+
+			// the error for the pending read. it's only reported once unless the socket is done receiving,
+			// the next read arms the receive again.
+			std::error_code take_receive_error() {
+				std::error_code ec = m_recvError;
+				if (!m_recvClosed) {
+					m_recvError = {};
+				}
+				return ec;
+			}
+
+			UringContext& m_context;
+			int m_fd;
+
+			UringOperation m_recvOp;
+			bool m_recvArmed = false;
+			bool m_waitingForBuffers = false;
+			std::error_code m_recvError;
+			// closed or at the end of the stream, m_recvError stays for every read after
+			bool m_recvClosed = false;
+			std::deque<Chunk> m_chunks;
+		};
+
+		struct UringTCPSocket : public UringSocketBase {
+			UringTCPSocket(UringContext& context, int fd)
+				: UringSocketBase(context, fd)
+			{
+				m_sendOp.complete = [this](int res, uint32_t flags) {
+					send_completed(res);
+				};
+			}
+
+			UringTCPSocket(UringContext& context, ASIO_TCP& socket)
+				: UringTCPSocket(context, socket.release())
+			{}
+
+			void read_async(uint8_t* const buffer, std::size_t count, IOCallback callback) override {
+				start_read(buffer, count, false, std::move(callback));
+			}
+
+			void read_some_async(uint8_t* const buffer, std::size_t count, IOCallback callback) override {
+				start_read(buffer, count, true, std::move(callback));
+			}
+
+			void write_async(uint8_t* const buffer, std::size_t count, IOCallback callback) override {
+				ConstByteBuffer buffers[1] = { { buffer, count } };
+				write_async(std::span<ConstByteBuffer const>(buffers), std::move(callback));
+			}
+
+			void write_async(std::span<ConstByteBuffer const> buffers, IOCallback callback) override {
+				m_sendTotal = 0;
+				m_sent = 0;
+				if (buffers.size() > ASYNC_IO_MAX_BUFFERS) {
+					m_sendCallback = std::move(callback);
+					m_context.defer([this]() {
+						finish_send(make_error_code(ErrorCode::MessageTooLarge));
+					});
+					return;
+				}
+				m_sendCount = buffers.size();
+				for (size_t i = 0; i < m_sendCount; ++i) {
+					m_sendVectors[i] = { const_cast<uint8_t*>(buffers[i].data), buffers[i].size };
+					m_sendTotal += buffers[i].size;
+				}
+				m_sendFirst = 0;
+				m_sendCallback = std::move(callback);
+				submit_send();
+			}
+
+		protected:
+			void prepare_receive(io_uring_sqe& sqe) override {
+				sqe.opcode = IORING_OP_RECV;
+				sqe.ioprio = IORING_RECV_MULTISHOT;
+			}
+
+			bool end_of_stream_on_empty() const override {
+				return true;
+			}
+
+			void start_read(uint8_t* buffer, std::size_t count, bool some, IOCallback callback) {
+				m_readBuffer = buffer;
+				m_readCount = count;
+				m_readFilled = 0;
+				m_readSome = some;
+				m_readCallback = std::move(callback);
+				arm_receive();
+				if (!m_chunks.empty() || m_recvError) {
+					m_context.defer([this]() {
+						complete_read();
+					});
+				}
+			}
+
+			// copies what was received into the pending read, completes it when it has enough
+			void complete_read() override {
+				if (!m_readCallback) {
+					return;
+				}
+				while (m_readFilled < m_readCount && !m_chunks.empty()) {
+					Chunk& chunk = m_chunks.front();
+					size_t count = std::min<size_t>(chunk.size - chunk.offset, m_readCount - m_readFilled);
+					std::memcpy(m_readBuffer + m_readFilled, m_context.buffer(chunk.id) + chunk.offset, count);
+					m_readFilled += count;
+					chunk.offset += static_cast<uint32_t>(count);
+					if (chunk.offset == chunk.size) {
+						m_context.recycle(chunk.id);
+						m_chunks.pop_front();
+					}
+				}
+
+				std::error_code ec;
+				if (m_readFilled == m_readCount || (m_readSome && m_readFilled > 0)) {
+					ec = {};
+				}
+				else if (m_recvError) {
+					ec = take_receive_error();
+				}
+				else {
+					return;
+				}
+				auto callback = std::move(m_readCallback);
+				m_readCallback = nullptr;
+				callback(ec, m_readFilled);
+			}
+
+			void submit_send() {
+				if (m_fd < 0) {
+					finish_send(std::make_error_code(std::errc::operation_canceled));
+					return;
+				}
+				m_sendHeader = {};
+				m_sendHeader.msg_iov = m_sendVectors.data() + m_sendFirst;
+				m_sendHeader.msg_iovlen = m_sendCount - m_sendFirst;
+				io_uring_sqe& sqe = m_context.prepare(&m_sendOp, IORING_OP_SENDMSG, m_fd);
+				sqe.addr = reinterpret_cast<uint64_t>(&m_sendHeader);
+				sqe.len = 1;
+				sqe.msg_flags = MSG_NOSIGNAL;
+			}
+
+			void send_completed(int res) {
+				if (res < 0) {
+					finish_send(std::error_code(-res, std::system_category()));
+					return;
+				}
+				m_sent += res;
+				if (m_sent >= m_sendTotal) {
+					finish_send({});
+					return;
+				}
+				// partial send, skip what went out and send the rest
+				size_t done = static_cast<size_t>(res);
+				while (done > 0 && done >= m_sendVectors[m_sendFirst].iov_len) {
+					done -= m_sendVectors[m_sendFirst].iov_len;
+					++m_sendFirst;
+				}
+				m_sendVectors[m_sendFirst].iov_base = static_cast<uint8_t*>(m_sendVectors[m_sendFirst].iov_base) + done;
+				m_sendVectors[m_sendFirst].iov_len -= done;
+				submit_send();
+			}
+
+			void finish_send(std::error_code ec) {
+				auto callback = std::move(m_sendCallback);
+				m_sendCallback = nullptr;
+				callback(ec, m_sent);
+			}
+
+			uint8_t* m_readBuffer = nullptr;
+			size_t m_readCount = 0;
+			size_t m_readFilled = 0;
+			bool m_readSome = false;
+			IOCallback m_readCallback;
+
+			UringOperation m_sendOp;
+			msghdr m_sendHeader{};
+			std::array<iovec, ASYNC_IO_MAX_BUFFERS> m_sendVectors;
+			size_t m_sendCount = 0;
+			size_t m_sendFirst = 0;
+			size_t m_sendTotal = 0;
+			size_t m_sent = 0;
+			IOCallback m_sendCallback;
+		};
+
+		// satisfies IBatchedDatagramIO, so UDPConnection moves whole batches of datagrams through it
+		struct UringUDPSocket : public UringSocketBase {
+			UringUDPSocket(UringContext& context, int fd)
+				: UringSocketBase(context, fd)
+			{
+				for (auto& op : m_sendOps) {
+					op.complete = [this](int res, uint32_t flags) {
+						send_completed(res);
+					};
+				}
+				m_recvHeader.msg_namelen = sizeof(sockaddr_storage);
+			}
+
+			UringUDPSocket(UringContext& context, ASIO_UDP& socket)
+				: UringUDPSocket(context, socket.release())
+			{}
+
+			void read_async(uint8_t* const buffer, std::size_t count, IOCallback callback) override {
+				m_single = { buffer, count, 0, {} };
+				m_singleCallback = std::move(callback);
+				read_batch_async(std::span<DatagramIn>(&m_single, 1), [this](std::error_code ec, size_t received) {
+					auto callback = std::move(m_singleCallback);
+					m_singleCallback = nullptr;
+					callback(ec, received > 0 ? m_single.size : 0);
+				});
+			}
+
+			// every datagram is a whole message already
+			void read_some_async(uint8_t* const buffer, std::size_t count, IOCallback callback) override {
+				read_async(buffer, count, std::move(callback));
+			}
+
+			void write_async(uint8_t* const buffer, std::size_t count, IOCallback callback) override {
+				ConstByteBuffer buffers[1] = { { buffer, count } };
+				write_async(std::span<ConstByteBuffer const>(buffers), std::move(callback));
+			}
+
+			void write_async(std::span<ConstByteBuffer const> buffers, IOCallback callback) override {
+				DatagramOut datagram = { m_remoteOutEndPoint, buffers };
+				write_batch_async(std::span<DatagramOut const>(&datagram, 1), std::move(callback));
+			}
+
+			void read_batch_async(std::span<DatagramIn> datagrams, IOCallback callback) {
+				m_readDatagrams = datagrams;
+				m_readCallback = std::move(callback);
+				arm_receive();
+				if (!m_chunks.empty() || m_recvError) {
+					m_context.defer([this]() {
+						complete_read();
+					});
+				}
+			}
+
+			// every datagram is its own sendmsg, all of them go to the kernel with the same io_uring_enter
+			// as many as fit into the iovecs are sent, the callback gets how many that were
+			void write_batch_async(std::span<DatagramOut const> datagrams, IOCallback callback) {
+				datagrams = datagrams.first(std::min<size_t>(datagrams.size(), BATCHED_UDP_MAX_DATAGRAMS));
+				size_t count = datagrams_fitting(datagrams, m_sendVectors.size());
+				m_sendCallback = std::move(callback);
+				m_sendPending = count;
+				m_sent = 0;
+				m_sendError = {};
+				if (m_fd < 0 || count == 0) {
+					m_sendPending = 0;
+					if (m_fd < 0) {
+						m_sendError = std::make_error_code(std::errc::operation_canceled);
+					}
+					else if (!datagrams.empty()) {
+						// the first datagram alone has more buffers than we can gather
+						m_sendError = make_error_code(ErrorCode::MessageTooLarge);
+					}
+					m_context.defer([this]() {
+						finish_send();
+					});
+					return;
+				}
+
+				size_t vectorCount = 0;
+				for (size_t i = 0; i < count; ++i) {
+					size_t buffers = datagrams[i].buffers.size();
+					for (size_t j = 0; j < buffers; ++j) {
+						m_sendVectors[vectorCount + j] = { const_cast<uint8_t*>(datagrams[i].buffers[j].data), datagrams[i].buffers[j].size };
+					}
+					m_sendEndpoints[i] = datagrams[i].endpoint;
+					m_sendHeaders[i] = {};
+					m_sendHeaders[i].msg_name = m_sendEndpoints[i].data();
+					m_sendHeaders[i].msg_namelen = static_cast<socklen_t>(m_sendEndpoints[i].size());
+					m_sendHeaders[i].msg_iov = &m_sendVectors[vectorCount];
+					m_sendHeaders[i].msg_iovlen = buffers;
+					vectorCount += buffers;
+
+					io_uring_sqe& sqe = m_context.prepare(&m_sendOps[i], IORING_OP_SENDMSG, m_fd);
+					sqe.addr = reinterpret_cast<uint64_t>(&m_sendHeaders[i]);
+					sqe.len = 1;
+				}
+			}
+
+			asio::ip::udp::endpoint const& remote_endpoint() const {
+				return m_remoteInEndPoint;
+			}
+
+		protected:
+			void prepare_receive(io_uring_sqe& sqe) override {
+				sqe.opcode = IORING_OP_RECVMSG;
+				sqe.ioprio = IORING_RECV_MULTISHOT;
+				sqe.addr = reinterpret_cast<uint64_t>(&m_recvHeader);
+				sqe.len = 1;
+			}
+
+			bool end_of_stream_on_empty() const override {
+				return false;
+			}
+
+			// hands out as many received datagrams as the pending batch has room for
+			void complete_read() override {
+				if (!m_readCallback) {
+					return;
+				}
+				size_t count = 0;
+				while (count < m_readDatagrams.size() && !m_chunks.empty()) {
+					Chunk chunk = m_chunks.front();
+					m_chunks.pop_front();
+					uint8_t* buffer = m_context.buffer(chunk.id);
+					// the buffer holds the recvmsg_out header, the source address, then the payload
+					io_uring_recvmsg_out out;
+					std::memcpy(&out, buffer, sizeof(out));
+					uint8_t* name = buffer + sizeof(out);
+					uint8_t* payload = name + m_recvHeader.msg_namelen + m_recvHeader.msg_controllen;
+					if ((out.flags & MSG_TRUNC) == 0) {
+						DatagramIn& datagram = m_readDatagrams[count++];
+						datagram.size = std::min<size_t>(out.payloadlen, datagram.capacity);
+						std::memcpy(datagram.data, payload, datagram.size);
+						size_t nameSize = std::min<size_t>(out.namelen, datagram.endpoint.capacity());
+						std::memcpy(datagram.endpoint.data(), name, nameSize);
+						datagram.endpoint.resize(nameSize);
+						m_remoteInEndPoint = datagram.endpoint;
+					}
+					// datagrams larger than a provided buffer are dropped
+					m_context.recycle(chunk.id);
+				}
+
+				if (count == 0 && !m_recvError) {
+					return;
+				}
+				auto callback = std::move(m_readCallback);
+				m_readCallback = nullptr;
+				callback(count > 0 ? std::error_code() : take_receive_error(), count);
+			}
+
+			void send_completed(int res) {
+				if (res < 0) {
+					if (!m_sendError) {
+						m_sendError = std::error_code(-res, std::system_category());
+					}
+				}
+				else {
+					++m_sent;
+				}
+				if (--m_sendPending == 0) {
+					finish_send();
+				}
+			}
+
+			void finish_send() {
+				auto callback = std::move(m_sendCallback);
+				m_sendCallback = nullptr;
+				callback(m_sendError, m_sent);
+			}
+
+			asio::ip::udp::endpoint m_remoteInEndPoint;
+			asio::ip::udp::endpoint m_remoteOutEndPoint;
+
+			msghdr m_recvHeader{};
+			DatagramIn m_single{};
+			IOCallback m_singleCallback;
+			std::span<DatagramIn> m_readDatagrams;
+			IOCallback m_readCallback;
+
+			std::array<UringOperation, BATCHED_UDP_MAX_DATAGRAMS> m_sendOps;
+			std::array<msghdr, BATCHED_UDP_MAX_DATAGRAMS> m_sendHeaders;
+			std::array<asio::ip::udp::endpoint, BATCHED_UDP_MAX_DATAGRAMS> m_sendEndpoints;
+			std::array<iovec, ASYNC_IO_MAX_BUFFERS> m_sendVectors;
+			size_t m_sendPending = 0;
+			size_t m_sent = 0;
+			std::error_code m_sendError;
+			IOCallback m_sendCallback;
+		};
+	}
+}
+#endif